@@ -0,0 +1,281 @@
+/*
+ * redraw decoding benchmark
+ *
+ * Compares the two decoders of the client itself (main.c is included with
+ * its main renamed, like bench/pipeline.c): msgpack_unpacker with an object
+ * tree per message that goes through process_message, and the read buffer
+ * framing with grid_line cells decoded in place (reader_process). The stream
+ * is fed in 64k chunks, like reads from the nvim pipe would be. The draw
+ * operations either one produces are taken off the ring after each chunk
+ * and summed instead of being applied, so this is decoding only. Reports
+ * bytes/s for each along with a checksum of the decoded cells so that the
+ * two can be compared.
+ *
+ * bench-decode [iterations [stream]], where stream is a recording made with
+ * NVIM_ARCAN_RECORD or a raw capture of what nvim writes to the ui - otherwise
+ * a synthetic one is generated with full screen grid_line batches.
+ */
+#define main nvim_arcan_main
+#include "main.c"
+#undef main
+
+#define COLS 200
+#define ROWS 60
+#define FRAMES 100
+#define CHUNK 65536
+
+struct result {
+	uint64_t cells;
+	uint64_t sum;
+};
+
+static void pack_str(msgpack_packer* pk, const char* str)
+{
+	size_t len = strlen(str);
+	msgpack_pack_str(pk, len);
+	msgpack_pack_str_body(pk, str, len);
+}
+
+/* text-like lines: a highlight change on each word, runs of blanks */
+static void generate(msgpack_sbuffer* sbuf)
+{
+	msgpack_packer pk;
+	msgpack_packer_init(&pk, sbuf, msgpack_sbuffer_write);
+
+	for (size_t frame = 0; frame < FRAMES; frame++){
+		msgpack_pack_array(&pk, 3);
+		msgpack_pack_int(&pk, 2);
+		pack_str(&pk, "redraw");
+		msgpack_pack_array(&pk, 3);
+
+		msgpack_pack_array(&pk, 1 + ROWS);
+		pack_str(&pk, "grid_line");
+
+		for (size_t row = 0; row < ROWS; row++){
+			size_t words = 8 + (row + frame) % 8;
+			size_t word_len = (COLS - 2 * words) / words;
+
+			msgpack_pack_array(&pk, 4);
+			msgpack_pack_int(&pk, 1);
+			msgpack_pack_int(&pk, row);
+			msgpack_pack_int(&pk, 0);
+
+			msgpack_pack_array(&pk, words * (word_len + 1));
+			for (size_t w = 0; w < words; w++){
+				for (size_t i = 0; i < word_len; i++){
+					char ch[3] = {'a' + (frame + row + w + i) % 26};
+					if ((row + i) % 37 == 0){
+						ch[0] = 0xc3;
+						ch[1] = 0xa9;
+					}
+
+					msgpack_pack_array(&pk, i == 0 ? 2 : 1);
+					pack_str(&pk, ch);
+					if (i == 0)
+						msgpack_pack_int(&pk, 1 + (w + row) % 40);
+				}
+
+				msgpack_pack_array(&pk, 3);
+				pack_str(&pk, " ");
+				msgpack_pack_int(&pk, 0);
+				msgpack_pack_int(&pk, 2);
+			}
+		}
+
+		msgpack_pack_array(&pk, 2);
+		pack_str(&pk, "grid_cursor_goto");
+		msgpack_pack_array(&pk, 3);
+		msgpack_pack_int(&pk, 1);
+		msgpack_pack_int(&pk, frame % ROWS);
+		msgpack_pack_int(&pk, 0);
+
+		msgpack_pack_array(&pk, 2);
+		pack_str(&pk, "flush");
+		msgpack_pack_array(&pk, 0);
+	}
+}
+
+/* either a raw capture or a NVIM_ARCAN_RECORD recording, for the latter only
+ * the recorded bytes are kept */
+static bool load(const char* path, msgpack_sbuffer* sbuf)
+{
+	FILE* fin = fopen(path, "r");
+	if (!fin)
+		return false;
+
+	char buf[CHUNK];
+	size_t nr = fread(buf, 1, 8, fin);
+
+	if (nr == 8 && memcmp(buf, "NVARREC1", 8) == 0){
+		uint64_t ts;
+		uint32_t len;
+
+		while (1 == fread(&ts, sizeof(ts), 1, fin) &&
+			1 == fread(&len, sizeof(len), 1, fin)){
+			while (len){
+				size_t n = len < sizeof(buf) ? len : sizeof(buf);
+				if (1 != fread(buf, n, 1, fin))
+					break;
+				msgpack_sbuffer_write(sbuf, buf, n);
+				len -= n;
+			}
+		}
+	}
+	else {
+		msgpack_sbuffer_write(sbuf, buf, nr);
+		while ((nr = fread(buf, 1, sizeof(buf), fin)) > 0)
+			msgpack_sbuffer_write(sbuf, buf, nr);
+	}
+
+	fclose(fin);
+	return true;
+}
+
+/* take everything decoded so far off the ring without applying it, a chunk
+ * is at most 64k cells so the ring never fills up in between */
+static void consume_ops(struct result* res)
+{
+	size_t tail = atomic_load_explicit(&ring.tail, memory_order_relaxed);
+	size_t head = atomic_load_explicit(&ring.head, memory_order_acquire);
+
+	for (; tail != head; tail++){
+		struct draw_op* op = &ring.ops[tail % OP_RING_SIZE];
+		if (op->kind == OP_CELL){
+			res->cells += op->cell.count;
+			res->sum += op->cell.ch + op->cell.hl * 31 + op->cell.count;
+		}
+		else if (op->kind == OP_TITLE)
+			free(op->title);
+	}
+
+	atomic_store_explicit(&ring.tail, tail, memory_order_release);
+}
+
+static struct result run_unpacker(const uint8_t* data, size_t size)
+{
+	struct result res = {0};
+	msgpack_unpacker unpack;
+	msgpack_unpacked result;
+
+	msgpack_unpacker_init(&unpack, MSGPACK_UNPACKER_INIT_BUFFER_SIZE);
+	msgpack_unpacked_init(&result);
+
+	for (size_t ofs = 0; ofs < size; ofs += CHUNK){
+		size_t n = size - ofs < CHUNK ? size - ofs : CHUNK;
+		msgpack_unpacker_reserve_buffer(&unpack, n);
+		memcpy(msgpack_unpacker_buffer(&unpack), &data[ofs], n);
+		msgpack_unpacker_buffer_consumed(&unpack, n);
+
+		while (MSGPACK_UNPACK_SUCCESS == msgpack_unpacker_next(&unpack, &result))
+			process_message(&result.data);
+		consume_ops(&res);
+	}
+
+	msgpack_unpacked_destroy(&result);
+	msgpack_unpacker_destroy(&unpack);
+	return res;
+}
+
+static struct result run_pull(const uint8_t* data, size_t size)
+{
+	struct result res = {0};
+
+	for (size_t ofs = 0; ofs < size; ofs += CHUNK){
+		size_t n = size - ofs < CHUNK ? size - ofs : CHUNK;
+
+/* same growth as read_nvim, a partial message can span several chunks */
+		size_t want = reader.used > n ? reader.used : n;
+		if (reader.cap - reader.used < want){
+			reader.cap = reader.used + want;
+			reader.buf = realloc(reader.buf, reader.cap);
+			if (!reader.buf){
+				fprintf(stderr, "bench: out of memory\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		memcpy(&reader.buf[reader.used], &data[ofs], n);
+		reader.used += n;
+		reader_process();
+		consume_ops(&res);
+	}
+
+	reader.used = 0;
+	return res;
+}
+
+static void report(const char* name,
+	struct result res, size_t bytes, uint64_t elapsed)
+{
+	printf("%s: %zu bytes in %"PRIu64" ns, %.1f MB/s "
+		"(%"PRIu64" cells, sum %"PRIx64")\n", name, bytes, elapsed,
+		(double) bytes * 1e9 / (double) elapsed / 1e6, res.cells, res.sum);
+}
+
+int main(int argc, char** argv)
+{
+	size_t iterations = 10;
+	if (argc > 1)
+		iterations = strtoul(argv[1], NULL, 10);
+
+/* the decoders only queue draw operations, but a stream can hold anything
+ * (e.g. a rpc request) so there is a full single-threaded client below */
+	struct nvim_meta* primary = malloc(sizeof(struct nvim_meta));
+	if (!primary || !u32map_insert(&nvim.grids, 1, &primary)){
+		fprintf(stderr, "bench: setup failed\n");
+		return EXIT_FAILURE;
+	}
+
+	*primary = (struct nvim_meta){
+		.grid_id = 1
+	};
+
+	arcan_tui_conn* conn = arcan_tui_open_display("NeoVim", "");
+	struct tui_cbcfg cbcfg = setup_nvim(primary);
+	nvim.tui = primary->tui = arcan_tui_setup(conn, NULL, &cbcfg, sizeof(cbcfg));
+	nvim.single_thread = true;
+	nvim.outq.fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	nvim.outq.threshold = 65536;
+	nvim.out = msgpack_packer_new(NULL, mpack_to_nvim);
+
+	if (!nvim.tui || -1 == nvim.outq.fd || !nvim.out || !setup_reader()){
+		fprintf(stderr, "bench: setup failed\n");
+		return EXIT_FAILURE;
+	}
+
+	msgpack_sbuffer sbuf;
+	msgpack_sbuffer_init(&sbuf);
+
+	if (argc > 2){
+		if (!load(argv[2], &sbuf)){
+			fprintf(stderr, "couldn't read %s\n", argv[2]);
+			return EXIT_FAILURE;
+		}
+	}
+	else
+		generate(&sbuf);
+
+	const uint8_t* data = (const uint8_t*) sbuf.data;
+	struct result tree = {0}, pull = {0};
+
+	uint64_t start = now_ns();
+	for (size_t i = 0; i < iterations; i++)
+		tree = run_unpacker(data, sbuf.size);
+	report("unpacker", tree, sbuf.size * iterations, now_ns() - start);
+
+	start = now_ns();
+	for (size_t i = 0; i < iterations; i++)
+		pull = run_pull(data, sbuf.size);
+	report("pull", pull, sbuf.size * iterations, now_ns() - start);
+
+	msgpack_sbuffer_destroy(&sbuf);
+
+	arcan_tui_destroy(nvim.tui, NULL);
+
+	if (tree.cells != pull.cells || tree.sum != pull.sum){
+		fprintf(stderr, "decoders disagree\n");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
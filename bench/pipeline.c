@@ -0,0 +1,821 @@
+/*
+ * redraw pipeline benchmarks
+ *
+ * Runs the client itself (main.c is included with its main renamed) on top of
+ * the headless tui backend, fed with workloads generated here instead of by
+ * nvim. Redraw messages go through the same framing, decoding, draw
+ * operations and flush as in single-threaded mode, requests are packed into
+ * the outgoing queue which is written to /dev/null. bchunk_import answers
+ * the requests of an import itself and fails if the buffer they would build
+ * isn't the input, byte for byte.
+ *
+ * bench-pipeline [case [iterations]], every case if none is given. Each case
+ * prints one line of JSON:
+ *
+ *  {"bench": name, "unit": what one op is, "ops": n,
+ *   "ns_per_op": x, "allocs_per_op": y}
+ *
+ * Allocations are counted by replacing malloc, calloc and realloc on top of
+ * glibc's __libc_* functions, so this can't be combined with a sanitizer -
+ * with any other libc allocs_per_op is null. One untimed run goes first so that
+ * buffers which only grow once don't show up in the counts.
+ */
+#define main nvim_arcan_main
+#include "main.c"
+#undef main
+
+#define COLS 200
+#define ROWS 60
+#define FRAMES 20
+#define HL_COUNT 64
+#define HL_DEFINE_COUNT 5000
+#define KEY_COUNT 1024
+#define KEY_BATCH 16
+#define EXPORT_LINES 100000
+#define EXPORT_REQID 0x7fff0000
+#define IMPORT_BUFFER 7
+
+/* everything runs on the main thread, there is no render thread here - only
+ * the export writer of buf_get_lines_threaded allocates on its own */
+static _Atomic uint64_t allocs;
+
+#ifdef __GLIBC__
+#define COUNT_ALLOCS
+
+extern void* __libc_malloc(size_t);
+extern void* __libc_calloc(size_t, size_t);
+extern void* __libc_realloc(void*, size_t);
+
+void* malloc(size_t size)
+{
+	allocs++;
+	return __libc_malloc(size);
+}
+
+void* calloc(size_t nmemb, size_t size)
+{
+	allocs++;
+	return __libc_calloc(nmemb, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+	allocs++;
+	return __libc_realloc(ptr, size);
+}
+#endif
+
+struct bench_case {
+	const char* name;
+	const char* unit;
+	size_t iterations;
+
+/* build the workload into [sbuf], returns the number of ops in one run */
+	uint64_t (*generate)(msgpack_sbuffer* sbuf);
+	void (*run)(const msgpack_sbuffer* sbuf);
+};
+
+static void pack_str(msgpack_packer* pk, const char* str)
+{
+	size_t len = strlen(str);
+	msgpack_pack_str(pk, len);
+	msgpack_pack_str_body(pk, str, len);
+}
+
+/* [2, "redraw", [...]] with room for [n] events */
+static void pack_redraw(msgpack_packer* pk, size_t n)
+{
+	msgpack_pack_array(pk, 3);
+	msgpack_pack_int(pk, 2);
+	pack_str(pk, "redraw");
+	msgpack_pack_array(pk, n);
+}
+
+static void pack_flush(msgpack_packer* pk)
+{
+	msgpack_pack_array(pk, 2);
+	pack_str(pk, "flush");
+	msgpack_pack_array(pk, 0);
+}
+
+static void pack_cursor(msgpack_packer* pk, size_t row, size_t col)
+{
+	msgpack_pack_array(pk, 2);
+	pack_str(pk, "grid_cursor_goto");
+	msgpack_pack_array(pk, 3);
+	msgpack_pack_int(pk, 1);
+	msgpack_pack_int(pk, row);
+	msgpack_pack_int(pk, col);
+}
+
+/* one [grid, row, col, cells] tuple of text-like cells, a highlight change on
+ * each word and a single space between words */
+static size_t pack_text_line(msgpack_packer* pk, size_t row, size_t seed)
+{
+	size_t words = 8 + (row + seed) % 8;
+	size_t word_len = COLS / words - 1;
+
+	msgpack_pack_array(pk, 4);
+	msgpack_pack_int(pk, 1);
+	msgpack_pack_int(pk, row);
+	msgpack_pack_int(pk, 0);
+	msgpack_pack_array(pk, words * (word_len + 1));
+
+	for (size_t w = 0; w < words; w++){
+		for (size_t i = 0; i < word_len; i++){
+			char ch[2] = {'a' + (seed + row + w + i) % 26};
+			msgpack_pack_array(pk, i == 0 ? 2 : 1);
+			pack_str(pk, ch);
+			if (i == 0)
+				msgpack_pack_int(pk, 1 + (w + row + seed) % (HL_COUNT - 1));
+		}
+
+		msgpack_pack_array(pk, 2);
+		pack_str(pk, " ");
+		msgpack_pack_int(pk, 0);
+	}
+
+	return words * (word_len + 1);
+}
+
+/* the framing loop from read_nvim, minus the read, then apply like the main
+ * loop does in single-threaded mode */
+static void feed(const uint8_t* buf, size_t len)
+{
+	struct mpull c = {.pos = buf, .end = buf + len};
+
+	while (c.pos < c.end){
+		const uint8_t* msg = c.pos;
+		if (mpull_skip(&c) != MPULL_OK){
+			fprintf(stderr, "bench: malformed workload\n");
+			exit(EXIT_FAILURE);
+		}
+
+		if (pull_redraw(msg, c.pos - msg))
+			continue;
+
+		size_t off = 0;
+		if (MSGPACK_UNPACK_SUCCESS == msgpack_unpack_next(
+			&reader.result, (const char*) msg, c.pos - msg, &off)){
+			process_message(&reader.result.data);
+		}
+	}
+
+	drain_ops();
+}
+
+static void run_feed(const msgpack_sbuffer* sbuf)
+{
+	feed((const uint8_t*) sbuf->data, sbuf->size);
+}
+
+/* full screen repaints, one message per frame */
+static uint64_t gen_grid_line(msgpack_sbuffer* sbuf)
+{
+	msgpack_packer pk;
+	msgpack_packer_init(&pk, sbuf, msgpack_sbuffer_write);
+	uint64_t cells = 0;
+
+	for (size_t frame = 0; frame < FRAMES; frame++){
+		pack_redraw(&pk, 3);
+		msgpack_pack_array(&pk, 1 + ROWS);
+		pack_str(&pk, "grid_line");
+		for (size_t row = 0; row < ROWS; row++)
+			cells += pack_text_line(&pk, row, frame);
+
+		pack_cursor(&pk, frame % ROWS, 0);
+		pack_flush(&pk);
+	}
+
+	return cells;
+}
+
+/* mostly blank lines, the way nvim sends an emptied or short buffer: a few
+ * cells of text and the rest of the row as one repeated cell */
+static uint64_t gen_grid_line_repeat(msgpack_sbuffer* sbuf)
+{
+	msgpack_packer pk;
+	msgpack_packer_init(&pk, sbuf, msgpack_sbuffer_write);
+	uint64_t cells = 0;
+
+	for (size_t frame = 0; frame < FRAMES; frame++){
+		pack_redraw(&pk, 2);
+		msgpack_pack_array(&pk, 1 + ROWS);
+		pack_str(&pk, "grid_line");
+
+		for (size_t row = 0; row < ROWS; row++){
+			size_t text = (row + frame) % 12;
+			msgpack_pack_array(&pk, 4);
+			msgpack_pack_int(&pk, 1);
+			msgpack_pack_int(&pk, row);
+			msgpack_pack_int(&pk, 0);
+			msgpack_pack_array(&pk, 2);
+
+			char ch[2] = {'a' + text};
+			msgpack_pack_array(&pk, 3);
+			pack_str(&pk, ch);
+			msgpack_pack_int(&pk, 1 + text);
+			msgpack_pack_int(&pk, text + 1);
+
+			msgpack_pack_array(&pk, 3);
+			pack_str(&pk, " ");
+			msgpack_pack_int(&pk, 0);
+			msgpack_pack_int(&pk, COLS - text - 1);
+			cells += COLS;
+		}
+
+		pack_flush(&pk);
+	}
+
+	return cells;
+}
+
+/* holding <C-e> on a full screen window: scroll one row, draw the exposed
+ * row, move the cursor and flush */
+static uint64_t gen_grid_scroll(msgpack_sbuffer* sbuf)
+{
+	msgpack_packer pk;
+	msgpack_packer_init(&pk, sbuf, msgpack_sbuffer_write);
+
+	for (size_t frame = 0; frame < FRAMES * 5; frame++){
+		pack_redraw(&pk, 4);
+
+		msgpack_pack_array(&pk, 2);
+		pack_str(&pk, "grid_scroll");
+		msgpack_pack_array(&pk, 7);
+		msgpack_pack_int(&pk, 1);
+		msgpack_pack_int(&pk, 0);
+		msgpack_pack_int(&pk, ROWS);
+		msgpack_pack_int(&pk, 0);
+		msgpack_pack_int(&pk, COLS);
+		msgpack_pack_int(&pk, 1);
+		msgpack_pack_int(&pk, 0);
+
+		msgpack_pack_array(&pk, 2);
+		pack_str(&pk, "grid_line");
+		pack_text_line(&pk, ROWS - 1, frame);
+
+		pack_cursor(&pk, ROWS - 1, 0);
+		pack_flush(&pk);
+	}
+
+	return FRAMES * 5;
+}
+
+/* a large colorscheme (or treesitter / semantic token groups) being loaded,
+ * all definitions in one event */
+static uint64_t gen_hl_attr_define(msgpack_sbuffer* sbuf)
+{
+	msgpack_packer pk;
+	msgpack_packer_init(&pk, sbuf, msgpack_sbuffer_write);
+
+	pack_redraw(&pk, 2);
+	msgpack_pack_array(&pk, 1 + HL_DEFINE_COUNT);
+	pack_str(&pk, "hl_attr_define");
+
+	for (size_t i = 1; i <= HL_DEFINE_COUNT; i++){
+		msgpack_pack_array(&pk, 4);
+		msgpack_pack_int(&pk, i);
+
+		msgpack_pack_map(&pk, 2 + (i % 3 == 0) + (i % 5 == 0));
+		pack_str(&pk, "foreground");
+		msgpack_pack_int(&pk, (i * 2654435761u) & 0xffffff);
+		pack_str(&pk, "background");
+		msgpack_pack_int(&pk, (i * 40503u) & 0xffffff);
+		if (i % 3 == 0){
+			pack_str(&pk, "bold");
+			msgpack_pack_true(&pk);
+		}
+		if (i % 5 == 0){
+			pack_str(&pk, "italic");
+			msgpack_pack_true(&pk);
+		}
+
+		msgpack_pack_map(&pk, 0);
+		msgpack_pack_array(&pk, 0);
+	}
+
+	pack_flush(&pk);
+	return HL_DEFINE_COUNT;
+}
+
+/* text with the odd special key, in the batches one arcan_tui_process call
+ * would deliver them */
+static uint64_t gen_input_keys(msgpack_sbuffer* sbuf)
+{
+	return KEY_COUNT;
+}
+
+static void run_input_keys(const msgpack_sbuffer* sbuf)
+{
+	static const uint32_t special[] = {
+		TUIK_LEFT, TUIK_DOWN, TUIK_ESCAPE, TUIK_F5, TUIK_PAGEDOWN
+	};
+	struct tui_context* T = nvim.tui;
+	void* tag = grids_get(1);
+
+	for (size_t i = 0; i < KEY_COUNT; i++){
+		if (i % 8 == 7)
+			on_key(T, special[(i / 8) % COUNT_OF(special)], 0,
+				i % 16 == 7 ? TUIM_LCTRL : 0, 0, tag);
+		else if (i % 64 == 1)
+			on_u8(T, "<", 1, tag);
+		else {
+			char ch = 'a' + i % 26;
+			on_u8(T, &ch, 1, tag);
+		}
+
+		if (i % KEY_BATCH == KEY_BATCH - 1){
+			flush_input();
+			rpc_flush();
+		}
+	}
+
+/* nothing answers the nvim_input requests here */
+	rpc_drop(&nvim.rpc.map);
+}
+
+/* the responses for an export of a large buffer: the buffer number and line
+ * count, then the nvim_buf_get_lines chunks. The request ids are pinned (see
+ * run_buf_get_lines) so that they can be built up front, [export_msgs] has
+ * where each response starts */
+static size_t export_msgs[EXPORT_LINES / EXPORT_CHUNK + 3];
+static size_t n_export_msgs;
+
+static uint64_t gen_buf_get_lines(msgpack_sbuffer* sbuf)
+{
+	msgpack_packer pk;
+	msgpack_packer_init(&pk, sbuf, msgpack_sbuffer_write);
+	char line[128];
+
+	n_export_msgs = 0;
+	export_msgs[n_export_msgs++] = sbuf->size;
+	msgpack_pack_array(&pk, 4);
+	msgpack_pack_int(&pk, 1);
+	msgpack_pack_uint32(&pk, EXPORT_REQID);
+	msgpack_pack_nil(&pk);
+	msgpack_pack_array(&pk, 2);
+	msgpack_pack_array(&pk, 2);
+	msgpack_pack_int(&pk, 1);
+	msgpack_pack_int(&pk, EXPORT_LINES);
+	msgpack_pack_nil(&pk);
+
+/* the last chunk is short, possibly empty */
+	for (size_t first = 0; first <= EXPORT_LINES; first += EXPORT_CHUNK){
+		size_t n = EXPORT_LINES - first < EXPORT_CHUNK ?
+			EXPORT_LINES - first : EXPORT_CHUNK;
+
+		export_msgs[n_export_msgs] = sbuf->size;
+		msgpack_pack_array(&pk, 4);
+		msgpack_pack_int(&pk, 1);
+		msgpack_pack_uint32(&pk, EXPORT_REQID + n_export_msgs++);
+		msgpack_pack_nil(&pk);
+		msgpack_pack_array(&pk, n);
+
+		for (size_t i = first; i < first + n; i++){
+			int len = snprintf(line, sizeof(line),
+				"%*sline %zu of the buffer, with some more text to make it longer",
+				(int)(i % 4) * 4, "", i);
+			msgpack_pack_str(&pk, len);
+			msgpack_pack_str_body(&pk, line, len);
+		}
+	}
+	export_msgs[n_export_msgs] = sbuf->size;
+
+	return EXPORT_LINES;
+}
+
+/* as if it had been read from nvim, the export takes over the buffer its
+ * responses are in */
+static void feed_reader(const uint8_t* buf, size_t len)
+{
+	if (reader.cap - reader.used < len){
+		reader.buf = realloc(reader.buf, reader.used + len);
+		reader.cap = reader.used + len;
+	}
+
+	if (!reader.buf){
+		fprintf(stderr, "bench: out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+
+	memcpy(&reader.buf[reader.used], buf, len);
+	reader.used += len;
+	reader_process();
+}
+
+/* one response at a time, the main loop would move the export along after
+ * each of them */
+static void run_buf_get_lines(const msgpack_sbuffer* sbuf)
+{
+	int fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	if (-1 == fd){
+		fprintf(stderr, "bench: couldn't open /dev/null\n");
+		exit(EXIT_FAILURE);
+	}
+
+	nvim.reqid = EXPORT_REQID;
+	export_start(fd);
+	rpc_flush();
+
+	for (size_t i = 0; i < n_export_msgs; i++){
+		feed_reader((const uint8_t*) &sbuf->data[export_msgs[i]],
+			export_msgs[i + 1] - export_msgs[i]);
+		export_pump();
+		rpc_flush();
+	}
+
+	if (nvim.exports.list){
+		fprintf(stderr, "bench: export didn't complete\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* main loop with the writer thread running: move the export along until it
+ * has asked for the next chunk, which it only does once the one before has
+ * been handed over, or until it is done */
+static void export_settle()
+{
+	for (;;){
+		export_pump();
+		rpc_flush();
+
+		pthread_mutex_lock(&nvim.exports.lock);
+		bool settled = !nvim.exports.list || nvim.exports.list->requested;
+		pthread_mutex_unlock(&nvim.exports.lock);
+
+		if (settled)
+			return;
+
+		struct pollfd pfd = {.fd = nvim.wakeup, .events = POLLIN};
+		if (1 == poll(&pfd, 1, -1)){
+			uint64_t val;
+			read(nvim.wakeup, &val, sizeof(val));
+		}
+	}
+}
+
+/* the same as buf_get_lines, with the writes on the writer thread as they
+ * are outside of single-threaded mode. The thread is started on each run and
+ * stopped at the end of it so that the other cases stay single-threaded */
+static void run_buf_get_lines_threaded(const msgpack_sbuffer* sbuf)
+{
+	int fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	if (-1 == fd){
+		fprintf(stderr, "bench: couldn't open /dev/null\n");
+		exit(EXIT_FAILURE);
+	}
+
+	nvim.single_thread = false;
+	nvim.reqid = EXPORT_REQID;
+	export_start(fd);
+	rpc_flush();
+
+	if (!nvim.exports.writer_running){
+		fprintf(stderr, "bench: couldn't start the export writer\n");
+		exit(EXIT_FAILURE);
+	}
+
+	for (size_t i = 0; i < n_export_msgs; i++){
+		feed_reader((const uint8_t*) &sbuf->data[export_msgs[i]],
+			export_msgs[i + 1] - export_msgs[i]);
+		export_settle();
+	}
+
+	bool done = !nvim.exports.list;
+	export_cancel();
+	nvim.exports.quit = false;
+	nvim.single_thread = true;
+
+	if (!done){
+		fprintf(stderr, "bench: export didn't complete\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* lines from empty to a few times the import read buffer, with the ends of
+ * the long ones at and next to where a full buffer would cut them, and the
+ * last line without a newline */
+static uint64_t gen_bchunk_import(msgpack_sbuffer* sbuf)
+{
+	static const size_t lens[] = {
+		0, 80, IMPORT_BYTES - 1, IMPORT_BYTES, 3, IMPORT_BYTES + 1,
+		2 * IMPORT_BYTES + 17, 0, 120, 3 * IMPORT_BYTES
+	};
+	char line[128];
+
+	for (size_t i = 0; i < COUNT_OF(lens); i++){
+		for (size_t left = lens[i]; left;){
+			size_t n = left < sizeof(line) ? left : sizeof(line);
+			memset(line, 'a' + i, n);
+			msgpack_sbuffer_write(sbuf, line, n);
+			left -= n;
+		}
+		msgpack_sbuffer_write(sbuf, "\n", 1);
+
+		for (size_t j = 0; j < 1000; j++){
+			int len = snprintf(line, sizeof(line), "short line %zu\n", j);
+			msgpack_sbuffer_write(sbuf, line, len);
+		}
+	}
+	msgpack_sbuffer_write(sbuf, "no newline", 10);
+
+	return sbuf->size;
+}
+
+/* where the buffer the import requests build up has got to in the input */
+static struct import_check {
+	const uint8_t* data;
+	size_t size;
+	size_t pos;
+	uint64_t lines;
+	uint64_t line_len;
+} import_check;
+
+static void import_fail(const char* what)
+{
+	fprintf(stderr, "bench: import %s at byte %zu\n", what, import_check.pos);
+	exit(EXIT_FAILURE);
+}
+
+/* a line of the buffer, a new one or appended to the last one */
+static void import_line(struct mpull* c, bool new_line)
+{
+	const char* str;
+	uint32_t len;
+	if (!mpull_str(c, &str, &len))
+		import_fail("request is malformed");
+
+	if (new_line){
+		if (import_check.lines && (import_check.pos == import_check.size ||
+			import_check.data[import_check.pos++] != '\n'))
+			import_fail("breaks a line that isn't broken in the input");
+		import_check.lines++;
+		import_check.line_len = 0;
+	}
+
+	if (len > import_check.size - import_check.pos ||
+		memcmp(str, &import_check.data[import_check.pos], len) != 0)
+		import_fail("doesn't match the input");
+
+	import_check.pos += len;
+	import_check.line_len += len;
+}
+
+/* nvim's side of an import: the new buffer, then every batch succeeds. The
+ * requests are told apart by their number of arguments */
+static void import_answer()
+{
+	msgpack_sbuffer resp;
+	msgpack_sbuffer_init(&resp);
+	msgpack_packer pk;
+	msgpack_packer_init(&pk, &resp, msgpack_sbuffer_write);
+
+	struct mpull c = {
+		.pos = (const uint8_t*) nvim.outq.buf,
+		.end = (const uint8_t*) nvim.outq.buf + nvim.outq.used
+	};
+
+	while (c.pos < c.end){
+		uint32_t n;
+		uint64_t type, id, buffer, row, col, end_row, end_col;
+		int64_t first, last;
+
+		if (!mpull_array(&c, &n) || n != 4 || !mpull_uint(&c, &type) ||
+			!mpull_uint(&c, &id) || MPULL_OK != mpull_skip(&c) ||
+			!mpull_array(&c, &n))
+			import_fail("request is malformed");
+
+		msgpack_pack_array(&pk, 4);
+		msgpack_pack_int(&pk, 1);
+		msgpack_pack_uint32(&pk, id);
+		msgpack_pack_nil(&pk);
+
+/* nvim_call_atomic in import_resolve: [[nil, bufnr], nil] */
+		if (n == 1){
+			mpull_skip(&c);
+			msgpack_pack_array(&pk, 2);
+			msgpack_pack_array(&pk, 2);
+			msgpack_pack_nil(&pk);
+			msgpack_pack_int(&pk, IMPORT_BUFFER);
+			msgpack_pack_nil(&pk);
+			continue;
+		}
+
+/* nvim_buf_set_lines, starting a new buffer or appending lines */
+		if (n == 5){
+			if (!mpull_uint(&c, &buffer) || !mpull_int(&c, &first) ||
+				!mpull_int(&c, &last) || MPULL_OK != mpull_skip(&c) ||
+				!mpull_array(&c, &n) || buffer != IMPORT_BUFFER || last != -1 ||
+				first != (import_check.lines ? -1 : 0))
+				import_fail("nvim_buf_set_lines is off");
+
+			for (uint32_t i = 0; i < n; i++)
+				import_line(&c, true);
+		}
+
+/* nvim_buf_set_text, continuing the last line */
+		else if (n == 6){
+			if (!mpull_uint(&c, &buffer) || !mpull_uint(&c, &row) ||
+				!mpull_uint(&c, &col) || !mpull_uint(&c, &end_row) ||
+				!mpull_uint(&c, &end_col) || !mpull_array(&c, &n) || !n ||
+				buffer != IMPORT_BUFFER || !import_check.lines ||
+				row != import_check.lines - 1 || end_row != row ||
+				col != import_check.line_len || end_col != col)
+				import_fail("nvim_buf_set_text is off");
+
+			for (uint32_t i = 0; i < n; i++)
+				import_line(&c, i > 0);
+		}
+		else
+			import_fail("sent an unexpected request");
+
+		msgpack_pack_nil(&pk);
+	}
+
+	rpc_flush();
+	feed_reader((const uint8_t*) resp.data, resp.size);
+	msgpack_sbuffer_destroy(&resp);
+}
+
+/* a regular file, streamed rather than read by nvim, with the requests and
+ * responses in lockstep as they would be in the main loop */
+static void run_bchunk_import(const msgpack_sbuffer* sbuf)
+{
+	char path[] = "/tmp/bench-import-XXXXXX";
+	int fd = mkstemp(path);
+	if (-1 != fd)
+		unlink(path);
+
+	if (-1 == fd || (ssize_t) sbuf->size != write(fd, sbuf->data, sbuf->size)){
+		fprintf(stderr, "bench: couldn't write the import input\n");
+		exit(EXIT_FAILURE);
+	}
+
+	import_check = (struct import_check){
+		.data = (const uint8_t*) sbuf->data,
+		.size = sbuf->size
+	};
+
+/* the batches are read back out of the queue, which mustn't be flushed
+ * before that */
+	size_t threshold = nvim.outq.threshold;
+	nvim.outq.threshold = SIZE_MAX;
+	nvim.transfer = TRANSFER_STREAM;
+	import_start(fd, 0);
+
+	while (nvim.imports.list){
+		import_answer();
+		import_pump();
+	}
+
+	nvim.transfer = TRANSFER_AUTO;
+	nvim.outq.threshold = threshold;
+
+	if (import_check.pos != import_check.size)
+		import_fail("stopped short of the input");
+}
+
+static const struct bench_case cases[] = {
+	{"grid_line_flood", "cell", 50, gen_grid_line, run_feed},
+	{"grid_line_repeat", "cell", 500, gen_grid_line_repeat, run_feed},
+	{"grid_scroll_full", "scroll", 20, gen_grid_scroll, run_feed},
+	{"hl_attr_define", "define", 50, gen_hl_attr_define, run_feed},
+	{"input_keys", "key", 500, gen_input_keys, run_input_keys},
+	{"buf_get_lines", "line", 10, gen_buf_get_lines, run_buf_get_lines},
+	{"buf_get_lines_threaded", "line", 10,
+		gen_buf_get_lines, run_buf_get_lines_threaded},
+	{"bchunk_import", "byte", 10, gen_bchunk_import, run_bchunk_import}
+};
+
+/* the state a session would be in before any of the workloads: a grid the
+ * size of the screen, default colors and the highlights the text uses */
+static void setup_session()
+{
+	msgpack_sbuffer sbuf;
+	msgpack_sbuffer_init(&sbuf);
+	msgpack_packer pk;
+	msgpack_packer_init(&pk, &sbuf, msgpack_sbuffer_write);
+
+	pack_redraw(&pk, 4);
+
+	msgpack_pack_array(&pk, 2);
+	pack_str(&pk, "grid_resize");
+	msgpack_pack_array(&pk, 3);
+	msgpack_pack_int(&pk, 1);
+	msgpack_pack_int(&pk, COLS);
+	msgpack_pack_int(&pk, ROWS);
+
+	msgpack_pack_array(&pk, 2);
+	pack_str(&pk, "default_colors_set");
+	msgpack_pack_array(&pk, 5);
+	msgpack_pack_int(&pk, 0xd0d0d0);
+	msgpack_pack_int(&pk, 0x101010);
+	msgpack_pack_int(&pk, 0xff0000);
+	msgpack_pack_int(&pk, 7);
+	msgpack_pack_int(&pk, 0);
+
+	msgpack_pack_array(&pk, HL_COUNT);
+	pack_str(&pk, "hl_attr_define");
+	for (size_t i = 1; i < HL_COUNT; i++){
+		msgpack_pack_array(&pk, 4);
+		msgpack_pack_int(&pk, i);
+		msgpack_pack_map(&pk, 1);
+		pack_str(&pk, "foreground");
+		msgpack_pack_int(&pk, 0x404040 + i * 0x030201);
+		msgpack_pack_map(&pk, 0);
+		msgpack_pack_array(&pk, 0);
+	}
+
+	pack_flush(&pk);
+	feed((const uint8_t*) sbuf.data, sbuf.size);
+	msgpack_sbuffer_destroy(&sbuf);
+}
+
+static void run_case(const struct bench_case* bc, size_t iterations)
+{
+	msgpack_sbuffer sbuf;
+	msgpack_sbuffer_init(&sbuf);
+	uint64_t ops = bc->generate(&sbuf) * iterations;
+
+	bc->run(&sbuf);
+
+	uint64_t start_allocs = allocs;
+	uint64_t start = now_ns();
+	for (size_t i = 0; i < iterations; i++)
+		bc->run(&sbuf);
+	uint64_t elapsed = now_ns() - start;
+	uint64_t n_allocs = allocs - start_allocs;
+
+	printf("{\"bench\": \"%s\", \"unit\": \"%s\", \"ops\": %"PRIu64", "
+		"\"ns_per_op\": %.2f, ", bc->name, bc->unit, ops,
+		ops ? (double) elapsed / ops : 0.0);
+
+#ifdef COUNT_ALLOCS
+	printf("\"allocs_per_op\": %.4f}\n", ops ? (double) n_allocs / ops : 0.0);
+#else
+	(void) n_allocs;
+	printf("\"allocs_per_op\": null}\n");
+#endif
+	fflush(stdout);
+
+	msgpack_sbuffer_destroy(&sbuf);
+}
+
+int main(int argc, char** argv)
+{
+	char size[32];
+	snprintf(size, sizeof(size), "%dx%d", COLS, ROWS);
+	setenv("NVIM_ARCAN_HEADLESS_SIZE", size, 1);
+
+	arcan_tui_conn* conn = arcan_tui_open_display("NeoVim", "");
+	struct nvim_meta* primary = malloc(sizeof(struct nvim_meta));
+	if (!primary || !u32map_insert(&nvim.grids, 1, &primary)){
+		fprintf(stderr, "bench: setup failed\n");
+		return EXIT_FAILURE;
+	}
+
+	*primary = (struct nvim_meta){
+		.grid_id = 1
+	};
+
+	struct tui_cbcfg cbcfg = setup_nvim(primary);
+	nvim.tui = primary->tui = arcan_tui_setup(conn, NULL, &cbcfg, sizeof(cbcfg));
+	nvim.single_thread = true;
+
+/* where the export writer says it is done with a chunk */
+	nvim.wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	nvim.outq.fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	nvim.outq.threshold = 65536;
+	nvim.out = msgpack_packer_new(NULL, mpack_to_nvim);
+
+	if (!nvim.tui || -1 == nvim.wakeup || -1 == nvim.outq.fd || !nvim.out ||
+		!setup_reader()){
+		fprintf(stderr, "bench: setup failed\n");
+		return EXIT_FAILURE;
+	}
+
+	nvim.defattr = arcan_tui_defattr(nvim.tui, NULL);
+	setup_session();
+
+	size_t iterations = 0;
+	if (argc > 2)
+		iterations = strtoul(argv[2], NULL, 10);
+
+	bool found = false;
+	for (size_t i = 0; i < COUNT_OF(cases); i++){
+		if (argc > 1 && strcmp(argv[1], cases[i].name) != 0)
+			continue;
+
+		run_case(&cases[i], iterations ? iterations : cases[i].iterations);
+		found = true;
+	}
+
+	if (!found){
+		fprintf(stderr, "bench: unknown case %s\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	arcan_tui_destroy(nvim.tui, NULL);
+	return EXIT_SUCCESS;
+}
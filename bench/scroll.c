@@ -0,0 +1,91 @@
+/*
+ * grid_scroll benchmark
+ *
+ * Simulates holding <C-e> / <C-y> on a large window: each iteration scrolls
+ * the region one row, redraws the exposed row like nvim would with a
+ * grid_line and diffs the result against a screen mirror the way a flush
+ * does (minus the actual tui writes). Reports the
+ * number of scrolled rows per second for a full width region and for one
+ * side of a vertical split.
+ */
+#include <arcan_shmif.h>
+#include <arcan_tui.h>
+#include <inttypes.h>
+#include <time.h>
+#include "shadow.h"
+
+#define COLS 300
+#define ROWS 90
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static size_t apply(struct shadow_grid* screen, struct shadow_grid* g)
+{
+	size_t changed = 0;
+
+	for (size_t row = 0; row < g->rows; row++){
+		if (!shadow_row_dirty(g, row))
+			continue;
+
+		struct shadow_cell* src = shadow_row(g, row);
+		struct shadow_cell* dst = shadow_row(screen, row);
+		for (size_t col = g->span[row].lo; col < g->span[row].hi; col++){
+			if (!shadow_cell_equal(&src[col], &dst[col])){
+				dst[col] = src[col];
+				changed++;
+			}
+		}
+	}
+
+	shadow_clean(g);
+	return changed;
+}
+
+static void run(const char* name,
+	size_t left, size_t right, size_t iterations)
+{
+	struct tui_screen_attr attr = {.fc = {0xff, 0xff, 0xff}};
+	struct shadow_grid back = {0}, screen = {0};
+	size_t changed = 0;
+
+	if (!shadow_resize(&back, COLS, ROWS, &attr) ||
+		!shadow_resize(&screen, COLS, ROWS, &attr)){
+		fprintf(stderr, "%s: couldn't allocate grid\n", name);
+		exit(EXIT_FAILURE);
+	}
+
+	uint64_t start = now_ns();
+	for (size_t i = 0; i < iterations; i++){
+		bool down = (i / ROWS) % 2;
+		shadow_scroll(&back, 0, ROWS, left, right, down ? -1 : 1);
+
+		size_t exposed = down ? 0 : ROWS - 1;
+		shadow_write(&back, left, exposed, 'a' + i % 26, &attr, right - left);
+		changed += apply(&screen, &back);
+	}
+	uint64_t elapsed = now_ns() - start;
+
+	printf("%s: %zu rows in %"PRIu64" ns, %.0f rows/s (%zu cells changed)\n",
+		name, iterations, elapsed,
+		(double) iterations * 1e9 / (double) elapsed, changed);
+
+	shadow_free(&back);
+	shadow_free(&screen);
+}
+
+int main(int argc, char** argv)
+{
+	size_t iterations = 100000;
+	if (argc > 1)
+		iterations = strtoul(argv[1], NULL, 10);
+
+	run("full", 0, COLS, iterations);
+	run("split", 0, COLS / 2, iterations);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,416 @@
+/*
+ * Headless tui backend
+ *
+ * Implements the part of the arcan_tui API that the frontend uses on top of
+ * an in-memory cell buffer, so that the whole client can run (and be timed,
+ * typically with --replay) without a display server. Linked instead of the
+ * tui library in the nvim-arcan-headless build.
+ *
+ * Environment:
+ *  NVIM_ARCAN_HEADLESS_SIZE : COLSxROWS, defaults to 80x25
+ *  NVIM_ARCAN_HEADLESS_DUMP : where the screen is written when the context
+ *                             is destroyed, "-" for stdout - subwindows go
+ *                             to the same path with .<id> appended
+ *
+ * Subwindow requests are always granted, on the next arcan_tui_process.
+ *
+ * The dump is plain text meant to be diffed against a golden copy: a header
+ * line, the rows of characters and the rows again with each cell replaced by
+ * a symbol for its attribute, with the symbols defined in order of first use.
+ */
+#include <arcan_shmif.h>
+#include <arcan_tui.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <poll.h>
+#include <errno.h>
+
+struct tui_context {
+	struct tui_cbcfg cfg;
+	size_t cols, rows;
+	size_t cx, cy;
+	struct tui_cell* cells;
+	struct tui_screen_attr defattr;
+	char* ident;
+	bool announced;
+
+/* set for subwindows, [wnd_id] is what it was requested with */
+	struct tui_context* parent;
+	uint16_t wnd_id;
+};
+
+/* there is no connection, this is only handed back to arcan_tui_setup */
+static int headless_conn;
+
+/* a pending subwindow, which is also what is handed to the subwindow handler
+ * as the connection for it */
+struct subwnd_req {
+	struct tui_context* parent;
+	unsigned type;
+	uint16_t id;
+};
+
+static struct {
+	struct subwnd_req* set;
+	size_t count, cap;
+} requests;
+
+arcan_tui_conn* arcan_tui_open_display(const char* title, const char* ident)
+{
+	return (arcan_tui_conn*) &headless_conn;
+}
+
+static void erase(struct tui_context* T, size_t x1, size_t y1, size_t x2, size_t y2)
+{
+	for (size_t y = y1; y <= y2 && y < T->rows; y++){
+		for (size_t x = x1; x <= x2 && x < T->cols; x++){
+			T->cells[y * T->cols + x] = (struct tui_cell){
+				.ch = ' ',
+				.attr = T->defattr
+			};
+		}
+	}
+}
+
+struct tui_context* arcan_tui_setup(arcan_tui_conn* con,
+	struct tui_context* parent, const struct tui_cbcfg* cfg, size_t cfg_sz, ...)
+{
+	size_t cols = 80, rows = 25;
+	const char* size = getenv("NVIM_ARCAN_HEADLESS_SIZE");
+	if (size && (2 != sscanf(size, "%zux%zu", &cols, &rows) || !cols || !rows)){
+		cols = 80;
+		rows = 25;
+	}
+
+	struct tui_context* T = malloc(sizeof(struct tui_context));
+	if (!T)
+		return NULL;
+
+	*T = (struct tui_context){
+		.cols = cols,
+		.rows = rows,
+		.cells = malloc(sizeof(struct tui_cell) * cols * rows),
+		.defattr = {
+			.fc = {0xff, 0xff, 0xff}
+		}
+	};
+
+	if (!T->cells){
+		free(T);
+		return NULL;
+	}
+
+	if (parent && con != (arcan_tui_conn*) &headless_conn){
+		T->parent = parent;
+		T->wnd_id = ((struct subwnd_req*) con)->id;
+	}
+
+	memcpy(&T->cfg, cfg, cfg_sz < sizeof(T->cfg) ? cfg_sz : sizeof(T->cfg));
+	erase(T, 0, 0, cols - 1, rows - 1);
+	return T;
+}
+
+static char attr_symbol(size_t i)
+{
+	static const char sym[] =
+		"abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+	return i < sizeof(sym) - 1 ? sym[i] : '?';
+}
+
+static bool attr_equal(const struct tui_screen_attr* a, const struct tui_screen_attr* b)
+{
+	return a->aflags == b->aflags &&
+		memcmp(a->fc, b->fc, 3) == 0 && memcmp(a->bc, b->bc, 3) == 0;
+}
+
+static void put_utf8(FILE* out, uint32_t cp)
+{
+	if (cp < 0x80)
+		fputc(cp, out);
+	else if (cp < 0x800){
+		fputc(0xc0 | (cp >> 6), out);
+		fputc(0x80 | (cp & 0x3f), out);
+	}
+	else if (cp < 0x10000){
+		fputc(0xe0 | (cp >> 12), out);
+		fputc(0x80 | ((cp >> 6) & 0x3f), out);
+		fputc(0x80 | (cp & 0x3f), out);
+	}
+	else {
+		fputc(0xf0 | (cp >> 18), out);
+		fputc(0x80 | ((cp >> 12) & 0x3f), out);
+		fputc(0x80 | ((cp >> 6) & 0x3f), out);
+		fputc(0x80 | (cp & 0x3f), out);
+	}
+}
+
+static void dump(struct tui_context* T, FILE* out)
+{
+	fprintf(out, "screen %zux%zu cursor %zu,%zu ident %s\n",
+		T->cols, T->rows, T->cx, T->cy, T->ident ? T->ident : "");
+
+	for (size_t y = 0; y < T->rows; y++){
+		for (size_t x = 0; x < T->cols; x++){
+			uint32_t ch = T->cells[y * T->cols + x].ch;
+			put_utf8(out, ch < 0x20 ? ' ' : ch);
+		}
+		fputc('\n', out);
+	}
+
+/* the attribute table is built in the order the attributes are first seen */
+	struct tui_screen_attr* seen = malloc(sizeof(struct tui_screen_attr) * 63);
+	size_t n_seen = 0;
+	if (!seen)
+		return;
+
+	fputs("attributes\n", out);
+	for (size_t y = 0; y < T->rows; y++){
+		for (size_t x = 0; x < T->cols; x++){
+			struct tui_screen_attr* attr = &T->cells[y * T->cols + x].attr;
+			size_t i = 0;
+			for (; i < n_seen && !attr_equal(&seen[i], attr); i++){}
+
+			if (i == n_seen && n_seen < 63)
+				seen[n_seen++] = *attr;
+
+			fputc(attr_symbol(i), out);
+		}
+		fputc('\n', out);
+	}
+
+	for (size_t i = 0; i < n_seen; i++){
+		fprintf(out, "%c fg %02x%02x%02x bg %02x%02x%02x flags %04"PRIx16"\n",
+			attr_symbol(i), seen[i].fc[0], seen[i].fc[1], seen[i].fc[2],
+			seen[i].bc[0], seen[i].bc[1], seen[i].bc[2], seen[i].aflags);
+	}
+
+	free(seen);
+}
+
+void arcan_tui_destroy(struct tui_context* T, const char* message)
+{
+	if (!T)
+		return;
+
+	if (message)
+		fprintf(stderr, "%s\n", message);
+
+/* a request it made can't be answered anymore */
+	for (size_t i = 0; i < requests.count;){
+		if (requests.set[i].parent == T)
+			requests.set[i] = requests.set[--requests.count];
+		else
+			i++;
+	}
+
+	const char* path = getenv("NVIM_ARCAN_HEADLESS_DUMP");
+	if (path){
+		char buf[PATH_MAX];
+		bool stdo = strcmp(path, "-") == 0;
+		if (!stdo && T->parent){
+			snprintf(buf, sizeof(buf), "%s.%"PRIu16, path, T->wnd_id);
+			path = buf;
+		}
+
+		FILE* out = stdo ? stdout : fopen(path, "w");
+		if (out){
+			dump(T, out);
+			if (out != stdout)
+				fclose(out);
+			else
+				fflush(out);
+		}
+	}
+
+	free(T->cells);
+	free(T->ident);
+	free(T);
+}
+
+struct tui_process_res arcan_tui_process(struct tui_context** contexts,
+	size_t n_contexts, int* fdset, size_t fdset_sz, int timeout)
+{
+	struct tui_process_res res = {0};
+
+/* in the order they were requested, handlers can request more and those
+ * wait for the next round */
+	struct subwnd_req* pending = requests.set;
+	size_t n_pending = requests.count;
+	requests.set = NULL;
+	requests.count = requests.cap = 0;
+
+	for (size_t i = 0; i < n_pending; i++){
+		struct subwnd_req* req = &pending[i];
+		if (req->parent->cfg.subwindow)
+			req->parent->cfg.subwindow(req->parent,
+				(arcan_tui_conn*) req, req->id, req->type, req->parent->cfg.tag);
+		timeout = 0;
+	}
+	free(pending);
+
+/* the size is known from the start, tell the client like the display would */
+	for (size_t i = 0; i < n_contexts; i++){
+		struct tui_context* T = contexts[i];
+		if (!T || T->announced)
+			continue;
+
+		T->announced = true;
+		if (T->cfg.resized)
+			T->cfg.resized(T, T->cols * 8, T->rows * 16, T->cols, T->rows, T->cfg.tag);
+		timeout = 0;
+	}
+
+	if (fdset_sz > 32)
+		fdset_sz = 32;
+
+	struct pollfd pfd[32];
+	for (size_t i = 0; i < fdset_sz; i++)
+		pfd[i] = (struct pollfd){.fd = fdset[i], .events = POLLIN};
+
+	if (-1 == poll(pfd, fdset_sz, timeout)){
+		if (errno != EINTR && errno != EAGAIN)
+			res.errc = -1;
+		return res;
+	}
+
+	for (size_t i = 0; i < fdset_sz; i++){
+		if (pfd[i].revents & POLLIN)
+			res.ok |= 1 << i;
+		else if (pfd[i].revents & (POLLERR | POLLHUP | POLLNVAL))
+			res.bad |= 1 << i;
+	}
+
+	return res;
+}
+
+int arcan_tui_refresh(struct tui_context* T)
+{
+	return 0;
+}
+
+void arcan_tui_move_to(struct tui_context* T, size_t x, size_t y)
+{
+	T->cx = x < T->cols ? x : T->cols - 1;
+	T->cy = y < T->rows ? y : T->rows - 1;
+}
+
+void arcan_tui_write(struct tui_context* T,
+	uint32_t ucode, const struct tui_screen_attr* attr)
+{
+	if (T->cx >= T->cols || T->cy >= T->rows)
+		return;
+
+	T->cells[T->cy * T->cols + T->cx] = (struct tui_cell){
+		.ch = ucode,
+		.attr = attr ? *attr : T->defattr
+	};
+
+/* like the real thing, the cursor stays on the last column */
+	if (T->cx + 1 < T->cols)
+		T->cx++;
+}
+
+bool arcan_tui_writeu8(struct tui_context* T,
+	const uint8_t* u8, size_t n, struct tui_screen_attr* attr)
+{
+	for (size_t i = 0; i < n;){
+		uint32_t cp = u8[i];
+		size_t len = cp >= 0xf0 ? 4 : cp >= 0xe0 ? 3 : cp >= 0xc0 ? 2 : 1;
+		if (cp >= 0x80 && cp < 0xc0)
+			return false;
+		if (i + len > n)
+			return false;
+
+		if (len > 1){
+			cp &= 0xff >> (len + 1);
+			for (size_t j = 1; j < len; j++)
+				cp = (cp << 6) | (u8[i + j] & 0x3f);
+		}
+
+		arcan_tui_write(T, cp, attr);
+		i += len;
+	}
+
+	return true;
+}
+
+struct tui_cell arcan_tui_getxy(struct tui_context* T, size_t x, size_t y, bool front)
+{
+	if (x >= T->cols || y >= T->rows)
+		return (struct tui_cell){0};
+
+	return T->cells[y * T->cols + x];
+}
+
+struct tui_screen_attr arcan_tui_defattr(
+	struct tui_context* T, struct tui_screen_attr* attr)
+{
+	struct tui_screen_attr old = T->defattr;
+	if (attr)
+		T->defattr = *attr;
+	return old;
+}
+
+void arcan_tui_erase_screen(struct tui_context* T, bool protect)
+{
+	erase(T, 0, 0, T->cols - 1, T->rows - 1);
+}
+
+void arcan_tui_erase_region(struct tui_context* T,
+	size_t x1, size_t y1, size_t x2, size_t y2, bool protect)
+{
+	erase(T, x1, y1, x2, y2);
+}
+
+void arcan_tui_dimensions(struct tui_context* T, size_t* rows, size_t* cols)
+{
+	*rows = T->rows;
+	*cols = T->cols;
+}
+
+void arcan_tui_ident(struct tui_context* T, const char* ident)
+{
+	free(T->ident);
+	T->ident = ident ? strdup(ident) : NULL;
+}
+
+/* nothing to show these on */
+void arcan_tui_set_color(struct tui_context* T, int group, uint8_t* rgb)
+{
+}
+
+void arcan_tui_set_bgcolor(struct tui_context* T, int group, uint8_t* rgb)
+{
+}
+
+void arcan_tui_set_flags(struct tui_context* T, int flags)
+{
+}
+
+void arcan_tui_announce_io(struct tui_context* T,
+	bool immediately, const char* input_descr, const char* output_descr)
+{
+}
+
+void arcan_tui_progress(struct tui_context* T, int type, float status)
+{
+}
+
+void arcan_tui_request_subwnd(struct tui_context* T, unsigned type, uint16_t id)
+{
+	if (requests.count == requests.cap){
+		size_t cap = requests.cap ? requests.cap * 2 : 8;
+		struct subwnd_req* set = realloc(requests.set, sizeof(struct subwnd_req) * cap);
+		if (!set)
+			return;
+
+		requests.set = set;
+		requests.cap = cap;
+	}
+
+	requests.set[requests.count++] = (struct subwnd_req){
+		.parent = T,
+		.type = type,
+		.id = id
+	};
+}
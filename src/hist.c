@@ -0,0 +1,59 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include "hist.h"
+
+static size_t bucket_index(uint64_t val)
+{
+	if (val < 2 * HIST_SUB)
+		return val;
+
+/* [exp] is the position of the highest bit, the HIST_SUB_BITS below it
+ * pick the sub-bucket */
+	size_t exp = 63 - __builtin_clzll(val);
+	size_t sub = val >> (exp - HIST_SUB_BITS);
+	return (exp - HIST_SUB_BITS) * HIST_SUB + sub;
+}
+
+static uint64_t bucket_high(size_t i)
+{
+	if (i < 2 * HIST_SUB)
+		return i;
+
+	size_t shift = i / HIST_SUB - 1;
+	uint64_t sub = i % HIST_SUB + HIST_SUB;
+	return ((sub + 1) << shift) - 1;
+}
+
+void hist_add(struct hist* h, uint64_t val)
+{
+	h->bucket[bucket_index(val)]++;
+	h->count++;
+	if (val > h->max)
+		h->max = val;
+}
+
+uint64_t hist_percentile(const struct hist* h, double pct)
+{
+	if (!h->count)
+		return 0;
+
+	uint64_t want = (uint64_t)(pct / 100.0 * (double) h->count + 0.5);
+	if (want < 1)
+		want = 1;
+
+	uint64_t seen = 0;
+	for (size_t i = 0; i < HIST_BUCKETS; i++){
+		seen += h->bucket[i];
+		if (seen >= want)
+			return bucket_high(i) < h->max ? bucket_high(i) : h->max;
+	}
+
+	return h->max;
+}
+
+void hist_reset(struct hist* h)
+{
+	memset(h, '\0', sizeof(struct hist));
+}
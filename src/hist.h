@@ -0,0 +1,32 @@
+/*
+ * Latency histogram
+ *
+ * Fixed size, log-linear buckets in the style of HdrHistogram: values below
+ * 2 * HIST_SUB are counted exactly, above that every power of two is split
+ * into HIST_SUB buckets, so a reported value is within ~3% of the recorded
+ * one over the whole uint64_t range. Recording is a couple of shifts and an
+ * increment, there is no allocation.
+ *
+ * Not thread safe, each histogram should only be touched by one thread.
+ */
+#ifndef NVIM_ARCAN_HIST_H
+#define NVIM_ARCAN_HIST_H
+
+#define HIST_SUB_BITS 5
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+struct hist {
+	uint64_t count;
+	uint64_t max;
+	uint64_t bucket[HIST_BUCKETS];
+};
+
+void hist_add(struct hist* h, uint64_t val);
+
+/* the highest value that is equivalent to the one at [pct] (0..100) */
+uint64_t hist_percentile(const struct hist* h, double pct);
+
+void hist_reset(struct hist* h);
+
+#endif
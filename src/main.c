@@ -20,7 +20,6 @@
 #include <arcan_shmif.h>
 #include <arcan_tui.h>
 #include <inttypes.h>
-#include <stdarg.h>
 #include <errno.h>
 #include <msgpack.h>
 #include <pthread.h>
@@ -28,7 +27,22 @@
 #include <errno.h>
 #include <ctype.h>
 #include <signal.h>
-#include "uthash.h"
+#include <fcntl.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/resource.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "shadow.h"
+#include "mpull.h"
+#include "hist.h"
+#include "metrics.h"
+#include "trace.h"
+#include "u32map.h"
 
 #ifndef COUNT_OF
 #define COUNT_OF(x) \
@@ -38,24 +52,190 @@
 struct hl_state {
 	struct tui_screen_attr attr;
 	bool got_fg, got_bg;
-	uint64_t id;
-	UT_hash_handle hh;
+	bool defined;
 };
 
-static struct hl_state* highlights;
+/*
+ * nvim highlight ids are small and dense, so they index directly into [state]
+ * (as defined by hl_attr_define) and [attr] (the same, with the default fg/bg
+ * colors folded in) - resolving a cell attribute is then a single load
+ */
+static struct {
+	struct hl_state* state;
+	struct tui_screen_attr* attr;
+	size_t count;
+} highlights;
+
+/*
+ * redraw events decoded into fixed size operations by the input thread, the
+ * render thread applies them to the shadow grids in order. grid_line is split
+ * into one OP_LINE (start position) followed by one OP_CELL per cell.
+ */
+enum draw_op_kind {
+	OP_RESIZE = 0,
+	OP_CLEAR,
+	OP_DESTROY,
+	OP_LINE,
+	OP_CELL,
+	OP_SCROLL,
+	OP_CURSOR,
+	OP_HL_DEFINE,
+	OP_DEFAULT_COLORS,
+	OP_TITLE,
+	OP_FLUSH
+};
+
+/* OP_CELL without a highlight id, keeps the one of the previous cell */
+#define CELL_HL_KEEP ((uint64_t) -1)
+
+struct draw_op {
+	uint32_t kind;
+	uint32_t grid;
+	union {
+		struct {
+			uint32_t cols, rows;
+		} resize;
+
+/* OP_LINE, OP_CURSOR */
+		struct {
+			uint32_t row, col;
+		} pos;
+
+		struct {
+			uint32_t ch;
+			uint32_t count;
+			uint64_t hl;
+		} cell;
+
+		struct {
+			uint32_t top, bottom, left, right;
+			int32_t rows;
+		} scroll;
+
+		struct {
+			uint32_t id;
+			uint16_t aflags;
+			bool got_fg, got_bg;
+			uint64_t fg, bg;
+		} hl;
+
+		struct {
+			uint64_t fg, bg;
+		} colors;
+
+/* OP_TITLE, ownership passes to the render thread */
+		char* title;
+
+/* OP_FLUSH, when the frame started and ended on the input side and when
+ * the oldest key it answers was pressed (0 if none) */
+		struct {
+			uint64_t frame_start;
+			uint64_t received;
+			uint64_t key;
+		} flush;
+	};
+};
+
+/*
+ * single producer (input thread), single consumer (render thread) ring, a
+ * full redraw of a large window is in the order of 30k cells - the producer
+ * only has to wait if the render thread falls more than a few frames behind
+ */
+#define OP_RING_SIZE 65536
+
+static struct {
+	struct draw_op ops[OP_RING_SIZE];
+	_Alignas(64) _Atomic size_t head;
+	_Alignas(64) _Atomic size_t tail;
+
+/* a producer that found the ring full sets [waiting] and blocks on [space]
+ * (eventfd), the consumer signals it when it hands slots back */
+	_Atomic bool waiting;
+	int space;
+} ring = {
+	.space = -1
+};
+
+struct nvim_meta {
+	int grid_id;
+	int button_mask;
+
+/* the context the grid is drawn to, NULL while the subwindow for it hasn't
+ * arrived yet - [wnd_id] is the id it was requested with */
+	struct tui_context* tui;
+	uint16_t wnd_id;
+
+/* pending mouse input, held until the end of the event loop iteration: a
+ * newer drag position replaces the older one and wheel ticks in the same
+ * direction accumulate into [count] - which may be more than goes out in one
+ * iteration, see MOUSE_WHEEL_MAX */
+	struct {
+		enum mouse_kind {
+			MOUSE_NONE = 0,
+			MOUSE_DRAG,
+			MOUSE_WHEEL
+		} kind;
+		const char* button;
+		const char* action;
+		int row, col;
+		size_t count;
+	} mouse;
+
+/* both owned by the render thread: [back] has the draw operations applied
+ * as they are dequeued, [screen] mirrors what has been written to the tui
+ * context so that on flush only cells that actually changed gets written */
+	struct shadow_grid back;
+	struct shadow_grid screen;
+};
+
+/* arcan_tui_process reports on its contexts in 32 bit masks */
+#define TUI_PROCESS_MAX 32
+
+/* [error] is NULL if the response had nil in its error slot, [result] is
+ * NULL if there was no response (see rpc_drop) */
+typedef void (*rpc_done)(void* tag,
+	const msgpack_object* error, const msgpack_object* result);
+
+/* a request that hasn't been answered yet, in nvim.rpc.map by msgid */
+struct rpc_pending {
+/* index into nvim.rpc_methods, for the statistics */
+	uint32_t method;
+	uint64_t sent;
+	rpc_done done;
+	void* tag;
+};
 
 static struct {
 /*
  * multiple grids will be dealt with in a serial manner through _process,
- * which means that [out] should not need a mutex for protection - but
- * there is a 'near' impossible edge where multiple contexts gets
- * multipart paste operations, though that would require some disturbing
- * behavior on the WM side */
+ * which means that [out] should not need a mutex for protection - and
+ * multipart pastes from several contexts at once are queued and sent one
+ * after the other (see paste_pump) */
 	msgpack_packer* out;
 	uint32_t reqid;
 
-	struct tui_context* grids[32];
-	size_t n_grids;
+/* [out] packs into this buffer rather than writing to the pipe directly, the
+ * start of each request is a commit point, and everything is written in one
+ * go from the main loop (rpc_flush) or when [threshold] bytes have built up */
+	struct {
+		char* buf;
+		size_t used, cap;
+		size_t threshold;
+		int fd;
+	} outq;
+
+/* every grid nvim has told us about by its id (render thread), grid 1 is
+ * the primary context [tui] and is always there. With multigrid the others
+ * get a subwindow of their own, see grid_create */
+	struct u32map grids;
+	struct tui_context* tui;
+	uint16_t wnd_id;
+
+/* the set of contexts handed to arcan_tui_process, see process_contexts */
+	struct {
+		struct tui_context* set[TUI_PROCESS_MAX];
+		size_t next;
+	} process;
 
 /* multigrid feature requires much more WM integration - safer to have
  * that as an opt-in rather than default */
@@ -67,91 +247,441 @@ static struct {
 /* externalize input prompt */
 	bool messages;
 
-/* need to track which, if any, grid is in multipart- paste state */
-	ssize_t paste_lock;
-
 /*
- * used for synching - there is an input thread for data coming from nvim
- * and a render thread for processing each active context. If there is input
- * that causes tui_writes while it is in a processing state, there is the
- * possibility of race condition causing cell contents to go out of synch
- *
- * due to the io-multiplex nature, we go with a synch-fd for waking up
- * and two mutexes to get the cvar-producer-consumer setup going - sigfd
- * accepts 'q' (quit) and 'l' (lock), synch guards the context and hold
- * keeps the main thread from starving lock on synch.
+ * there is an input thread for data coming from nvim and a render thread for
+ * processing each active context. The input thread never touches the grids,
+ * redraw events are decoded into draw operations that go through [ops] (see
+ * push_op) and the render thread applies them. There are no locks between
+ * the two, [wakeup] is an eventfd that is signalled when a frame is complete
+ * and [frame_pending] avoids signalling more than once per wakeup.
  */
-	pthread_mutex_t synch;
-	pthread_mutex_t hold;
-	int sigfd;
-	int lock_level;
+	int wakeup;
+	_Atomic bool frame_pending;
+	_Atomic bool quit;
+
+/* opt-in: the nvim output pipe is multiplexed with the tui contexts in
+ * arcan_tui_process and everything runs on the main thread, no input thread
+ * and the draw operations are applied inline. Replayed on a single core the
+ * two modes are within noise of each other in throughput, CPU time and
+ * flush->refresh latency */
+	bool single_thread;
+
+/* when the first redraw event after a flush was processed (input thread),
+ * sent along with the flush so the render thread can measure latency */
+	uint64_t frame_start;
+
+/* render thread, default attribute used for cells without a highlight */
+	struct tui_screen_attr defattr;
+
+/* cells received through grid_line (input thread) versus cells actually
+ * written to a tui context (render thread), these are also what is exported
+ * as metrics (see setup_metrics) so each is updated with metric_add/set from
+ * the one thread that owns it - except [transfers] */
+	struct {
+		_Atomic uint64_t cells_received;
+		_Atomic uint64_t cells_written;
+		_Atomic uint64_t keys;
+		_Atomic uint64_t key_requests;
+		_Atomic uint64_t bytes_in;
+		_Atomic uint64_t bytes_out;
+		_Atomic uint64_t write_calls;
+		_Atomic uint64_t mouse_dropped;
+		_Atomic uint64_t mouse_requests_saved;
+		_Atomic uint64_t frames;
+		_Atomic uint64_t frame_ns;
+		_Atomic uint64_t frame_ns_max;
+		_Atomic uint64_t flushes;
+		_Atomic uint64_t flush_ns;
+		_Atomic uint64_t flush_ns_max;
+		_Atomic uint64_t scroll_rows;
+		_Atomic uint64_t ring_wait_ns;
+		_Atomic uint64_t hl_slots;
+		_Atomic uint64_t hl_defined;
+		_Atomic uint64_t read_buffer;
+		_Atomic uint64_t transfers;
+	} stats;
+
+/* requests sent (main thread), by method as they are first used, and how
+ * many are waiting for a response - [rtt] is covered by rpc.lock */
+	struct {
+		char name[32];
+		_Atomic uint64_t count;
+		_Atomic uint64_t inflight;
+		_Atomic uint64_t errors;
+		struct hist rtt;
+	} rpc_methods[16];
+	size_t n_rpc_methods;
 
 /*
- * Used for outgoing bchunk requests (buffer copies), while there is strictly
- * no way to limit the number of outstanding copies here, at this level of
- * saturation there is a point to just block tui processing because this will
- * just amplify. The better option would be a way to forward this to the
- * vim process itself, but that seems ever worse of (msgpack and fd passing..)
+ * requests that haven't been answered yet (see rpc_request), they are sent
+ * from the main thread while the responses are processed on the input thread
+ * (or main thread in single-threaded mode), [lock] covers [map] and the
+ * round trip histograms
  */
+	struct {
+		pthread_mutex_t lock;
+		struct u32map map;
+	} rpc;
+
+/* buffer exports in progress (see export_pump), the list itself is only
+ * touched by the main thread. Unless single-threaded the writes are done by
+ * [writer] (see thread_export), jobs are handed to it through [queue] and
+ * [wakeup] tells it to look */
+	struct {
+		pthread_mutex_t lock;
+		struct export* list;
+		struct export* queue;
+		bool quit;
+		int wakeup;
+		bool writer_running;
+		pthread_t writer;
+	} exports;
+
+/* and imports (see import_pump), same arrangement */
+	struct {
+		pthread_mutex_t lock;
+		struct import* list;
+	} imports;
+
+/* pastes waiting to be sent (see paste_pump), the same again - [buffered]
+ * is the total not sent yet that is held in memory */
+	struct {
+		pthread_mutex_t lock;
+		struct paste* list;
+		size_t buffered;
+	} pastes;
+
+/* NVIM_ARCAN_TRANSFER=auto|direct|stream, whether nvim is asked to open
+ * bchunk fds itself (see transfer_direct) or the data is streamed over the
+ * rpc channel. Always stream when replaying, there is no nvim process. */
+	enum {
+		TRANSFER_AUTO = 0,
+		TRANSFER_DIRECT,
+		TRANSFER_STREAM
+	} transfer;
+
+/* NVIM_ARCAN_METRICS, listening socket that gets the metrics on connect */
 	struct {
 		int fd;
-		uint32_t reqid;
-		size_t pos;
-		void (*data)(size_t i, const msgpack_object_array*);
-	} pending[8];
+		const char* path;
+	} metrics;
+
+/*
+ * keypress to pixels: [key_start] is when the oldest key that hasn't been
+ * followed by a flush was queued (tui callbacks) and it is claimed by the
+ * next flush from nvim (input thread). The histograms are only touched by
+ * the render side and dumped on exit or when SIGUSR1 arrives on [sigfd].
+ */
+	struct {
+		_Atomic uint64_t key_start;
+		struct hist key_flush;
+		struct hist flush_refresh;
+		struct hist key_refresh;
+		int sigfd;
+	} latency;
+
+/* keyboard input gathered during one arcan_tui_process call, sent as a
+ * single nvim_input request by flush_keys - any other request built from
+ * the tui callbacks flushes this first so the order is preserved */
+	struct {
+		char buf[4096];
+		size_t ofs;
+		size_t count;
+	} keys;
 
-	FILE* trace_out;
+/* NVIM_ARCAN_RECORD, everything read from nvim is appended (see record) */
+	FILE* record_out;
+	uint64_t record_start;
+
+/* --replay file [--paced], a recording is fed instead of spawning nvim */
+	struct {
+		const char* path;
+		bool paced;
+		uint64_t start;
+	} replay;
 } nvim = {
-	.synch = PTHREAD_MUTEX_INITIALIZER,
-	.hold = PTHREAD_MUTEX_INITIALIZER,
-	.paste_lock = -1
+	.metrics.fd = -1,
+	.grids.size = sizeof(struct nvim_meta*),
+	.rpc.lock = PTHREAD_MUTEX_INITIALIZER,
+	.rpc.map.size = sizeof(struct rpc_pending),
+	.exports.lock = PTHREAD_MUTEX_INITIALIZER,
+	.exports.wakeup = -1,
+	.imports.lock = PTHREAD_MUTEX_INITIALIZER,
+	.pastes.lock = PTHREAD_MUTEX_INITIALIZER
 };
 
-struct nvim_meta {
-	int cx, cy;
-	int grid_id;
-	int button_mask;
-};
+/* the registry holds pointers to the grids, they stay put as it changes */
+static struct nvim_meta* grids_get(uint32_t grid)
+{
+	struct nvim_meta** m = u32map_get(&nvim.grids, grid);
+	return m ? *m : NULL;
+}
 
-static inline void trace(const char* msg, ...)
+static struct nvim_meta* grids_next(size_t* pos)
 {
-	if (!nvim.trace_out)
-		return;
+	struct nvim_meta** m = u32map_next(&nvim.grids, pos);
+	return m ? *m : NULL;
+}
 
-	va_list args;
-	va_start( args, msg );
-		vfprintf(nvim.trace_out,  msg, args );
-	va_end( args);
-	fputs("\n", nvim.trace_out);
+static uint64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
 }
 
-static void trace_obj_array(const msgpack_object_array* arg)
+static void drain_ops();
+
+static void wake_render()
 {
-	if (!nvim.trace_out)
-		return;
+	uint64_t val = 1;
+	write(nvim.wakeup, &val, sizeof(val));
+}
 
-	struct msgpack_object obj = {
-		.type = MSGPACK_OBJECT_ARRAY,
-		.via.array = *arg
-	};
+static void push_op(struct draw_op op)
+{
+	size_t head = atomic_load_explicit(&ring.head, memory_order_relaxed);
+	uint64_t wait_start = 0;
+
+/* full, in single-threaded mode we are the consumer as well - otherwise kick
+ * the render thread and sleep until it has handed back some slots. [waiting]
+ * is set before the tail is checked again, so either that check sees the new
+ * tail or the consumer sees [waiting] - a stale wakeup only costs a loop */
+	while (head - atomic_load_explicit(
+		&ring.tail, memory_order_acquire) == OP_RING_SIZE){
+		if (nvim.single_thread){
+			drain_ops();
+			continue;
+		}
 
-	msgpack_object_print(nvim.trace_out, obj);
-	fprintf(nvim.trace_out, "\n");
+		if (!wait_start)
+			wait_start = now_ns();
+
+		atomic_store(&ring.waiting, true);
+		if (head - atomic_load(&ring.tail) != OP_RING_SIZE)
+			break;
+
+		wake_render();
+		uint64_t val;
+		if (-1 == read(ring.space, &val, sizeof(val)) && errno != EINTR)
+			nanosleep(&(struct timespec){.tv_nsec = 100000}, NULL);
+	}
+
+	if (wait_start)
+		metric_add(&nvim.stats.ring_wait_ns, now_ns() - wait_start);
+
+	ring.ops[head % OP_RING_SIZE] = op;
+	atomic_store_explicit(&ring.head, head + 1, memory_order_release);
 }
 
-static uint32_t nvim_request_str(const char* str, size_t sz)
+static int mpack_to_nvim(void* data, const char* buf, size_t buf_out)
+{
+	if (nvim.outq.used + buf_out > nvim.outq.cap){
+		size_t cap = nvim.outq.cap ? nvim.outq.cap : 65536;
+		while (cap < nvim.outq.used + buf_out)
+			cap *= 2;
+
+		char* nb = realloc(nvim.outq.buf, cap);
+		if (!nb)
+			return -1;
+
+		nvim.outq.buf = nb;
+		nvim.outq.cap = cap;
+	}
+
+	memcpy(&nvim.outq.buf[nvim.outq.used], buf, buf_out);
+	nvim.outq.used += buf_out;
+	return 0;
+}
+
+/* write out all complete requests, this is only called between requests so
+ * everything in the buffer is complete */
+static void rpc_flush()
+{
+	size_t ofs = 0;
+
+	while (ofs < nvim.outq.used){
+		ssize_t nw = write(nvim.outq.fd, &nvim.outq.buf[ofs], nvim.outq.used - ofs);
+		metric_add(&nvim.stats.write_calls, 1);
+
+		if (-1 == nw){
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+
+			trace("rpc_flush: write error: %d", errno);
+			break;
+		}
+
+		ofs += nw;
+	}
+
+	metric_add(&nvim.stats.bytes_out, ofs);
+	trace_ev(TRACE_RPC_WRITE, 0, ofs, metric_get(&nvim.stats.write_calls), 0);
+	nvim.outq.used = 0;
+}
+
+static void rpc_method_metrics(size_t i)
+{
+	const char* name = nvim.rpc_methods[i].name;
+	metric_register("nvim_arcan_rpc_requests_total", "method",
+		name, METRIC_COUNTER, &nvim.rpc_methods[i].count);
+	metric_register("nvim_arcan_rpc_inflight", "method",
+		name, METRIC_GAUGE, &nvim.rpc_methods[i].inflight);
+	metric_register("nvim_arcan_rpc_errors_total", "method",
+		name, METRIC_COUNTER, &nvim.rpc_methods[i].errors);
+}
+
+/* index into rpc_methods, COUNT_OF(rpc_methods) once that is full */
+static size_t rpc_method(const char* str, size_t sz)
 {
+	for (size_t i = 0; i < nvim.n_rpc_methods; i++){
+		if (strlen(nvim.rpc_methods[i].name) == sz &&
+			memcmp(nvim.rpc_methods[i].name, str, sz) == 0)
+			return i;
+	}
+
+	if (nvim.n_rpc_methods == COUNT_OF(nvim.rpc_methods) ||
+		sz >= sizeof(nvim.rpc_methods[0].name))
+		return COUNT_OF(nvim.rpc_methods);
+
+	size_t i = nvim.n_rpc_methods++;
+	memcpy(nvim.rpc_methods[i].name, str, sz);
+
+	if (-1 != nvim.metrics.fd)
+		rpc_method_metrics(i);
+
+	return i;
+}
+
+/*
+ * start a request for method [str], the arguments are packed by the caller.
+ * [done] (optional) is called with the response from the thread that
+ * processes it, or with no result if it never arrives.
+ */
+static uint32_t rpc_request(
+	const char* str, size_t sz, rpc_done done, void* tag)
+{
+/* commit point, anything already in the buffer is a finished request */
+	if (nvim.outq.used >= nvim.outq.threshold)
+		rpc_flush();
+
+	size_t method = rpc_method(str, sz);
 	uint32_t id = nvim.reqid++;
 	msgpack_pack_array(nvim.out, 4);
 	msgpack_pack_int(nvim.out, 0);
 	msgpack_pack_uint32(nvim.out, id);
 	msgpack_pack_bin(nvim.out, sz);
 	msgpack_pack_bin_body(nvim.out, str, sz);
-/* out is already tied to our FILE- and that will flush for us,
- * possible hashtable on ID and add ourselves there */
+
+	pthread_mutex_lock(&nvim.rpc.lock);
+	bool ok = u32map_insert(&nvim.rpc.map, id, &(struct rpc_pending){
+		.method = method,
+		.sent = now_ns(),
+		.done = done,
+		.tag = tag
+	});
+	pthread_mutex_unlock(&nvim.rpc.lock);
+
+	if (method < COUNT_OF(nvim.rpc_methods)){
+		metric_add(&nvim.rpc_methods[method].count, 1);
+		if (ok)
+			atomic_fetch_add(&nvim.rpc_methods[method].inflight, 1);
+	}
+
+/* the response will show up as unknown, but the caller can clean up now */
+	if (!ok){
+		trace("rpc: couldn't track request %"PRIu32, id);
+		if (done)
+			done(tag, NULL, NULL);
+	}
+
 	return id;
 }
 
+static uint32_t nvim_request_str(const char* str, size_t sz)
+{
+	return rpc_request(str, sz, NULL, NULL);
+}
+
+/* [msgid, error, result], nvim errors are [type, message] */
+static void rpc_response(uint32_t msgid,
+	const msgpack_object* error, const msgpack_object* result)
+{
+	struct rpc_pending e;
+	bool known;
+
+	pthread_mutex_lock(&nvim.rpc.lock);
+	known = u32map_take(&nvim.rpc.map, msgid, &e);
+	if (known && e.method < COUNT_OF(nvim.rpc_methods))
+		hist_add(&nvim.rpc_methods[e.method].rtt, now_ns() - e.sent);
+	pthread_mutex_unlock(&nvim.rpc.lock);
+
+	if (!known){
+		trace("rpc: response to unknown request %"PRIu32, msgid);
+		return;
+	}
+
+	if (error->type == MSGPACK_OBJECT_NIL)
+		error = NULL;
+
+	if (e.method < COUNT_OF(nvim.rpc_methods)){
+		atomic_fetch_sub(&nvim.rpc_methods[e.method].inflight, 1);
+		if (error)
+			metric_add(&nvim.rpc_methods[e.method].errors, 1);
+	}
+
+	if (error){
+		const char* method =
+			e.method < COUNT_OF(nvim.rpc_methods) ? nvim.rpc_methods[e.method].name : "?";
+
+		if (error->type == MSGPACK_OBJECT_ARRAY && error->via.array.size == 2 &&
+			error->via.array.ptr[1].type == MSGPACK_OBJECT_STR){
+			const msgpack_object_str* msg = &error->via.array.ptr[1].via.str;
+			trace("rpc: %s (%"PRIu32") failed: %.*s",
+				method, msgid, (int) msg->size, msg->ptr);
+		}
+		else
+			trace("rpc: %s (%"PRIu32") failed", method, msgid);
+	}
+
+	if (e.done)
+		e.done(e.tag, error, result);
+}
+
+/* every request in [map] is called back with no result and the map is
+ * emptied - a callback may send a request of its own, so on shutdown the map
+ * is moved out of nvim.rpc.map (and its lock) first */
+static void rpc_drop(struct u32map* map)
+{
+	size_t pos = 0;
+	struct rpc_pending* e;
+	while ((e = u32map_next(map, &pos))){
+		if (e->done)
+			e->done(e->tag, NULL, NULL);
+	}
+
+	u32map_free(map);
+}
+
+static void flush_keys()
+{
+	if (!nvim.keys.ofs)
+		return;
+
+	const char cmd[] = "nvim_input";
+	nvim_request_str(cmd, sizeof(cmd) - 1);
+	msgpack_pack_array(nvim.out, 1);
+	msgpack_pack_str(nvim.out, nvim.keys.ofs);
+	msgpack_pack_str_body(nvim.out, nvim.keys.buf, nvim.keys.ofs);
+
+	trace_ev(TRACE_INPUT, 0, nvim.keys.count, nvim.keys.ofs, 0);
+	metric_add(&nvim.stats.keys, nvim.keys.count);
+	metric_add(&nvim.stats.key_requests, 1);
+
+	nvim.keys.ofs = 0;
+	nvim.keys.count = 0;
+}
+
 /*
  * static uint32_t nvim_set_key_i(const char* key, int val)
 {
@@ -188,10 +718,9 @@ static bool query_label(struct tui_context* ctx,
 static void update_cval(uint64_t val, uint8_t rgb[static 3])
 {
 	if ((uint64_t)-1 == val){
-		struct tui_screen_attr attr = arcan_tui_defattr(nvim.grids[0], NULL);
-		rgb[0] = attr.fc[0];
-		rgb[1] = attr.fc[1];
-		rgb[2] = attr.fc[2];
+		rgb[0] = nvim.defattr.fc[0];
+		rgb[1] = nvim.defattr.fc[1];
+		rgb[2] = nvim.defattr.fc[2];
 	}
 	else {
 		rgb[2] = (val & 0x000000ff);
@@ -213,7 +742,7 @@ static bool on_alabel(struct tui_context* c, const char* label,
 	return false;
 }
 
-static void build_mouse_packet(
+static void pack_mouse_args(
 	const char* button, const char* action,
 	const char* mod, int grid, int row, int col)
 {
@@ -223,8 +752,6 @@ static void build_mouse_packet(
 	if (mod_sz == 1)
 		mod_sz = 0;
 
-	const char mouse_cmd[] = "nvim_input_mouse";
-	nvim_request_str(mouse_cmd, sizeof(mouse_cmd) - 1);
 	msgpack_pack_array(nvim.out, 6);
 	msgpack_pack_str(nvim.out, button_sz);
 	msgpack_pack_str_body(nvim.out, button, button_sz);
@@ -237,146 +764,1571 @@ static void build_mouse_packet(
 	msgpack_pack_int(nvim.out, col);
 }
 
-static void handle_buffer_response(size_t i, const msgpack_object_array* arg)
+static void build_mouse_packet(
+	const char* button, const char* action,
+	const char* mod, int grid, int row, int col)
 {
-	trace("buffer-response");
-
-/* for larger responses we have the problem that this is blocking and nvim
- * stops being responsive in the interim, so in that case we should, at least,
- * forward progress about the transfer */
-	FILE* fout = fdopen(nvim.pending[i].fd, "w");
-	if (!fout){
-		close(nvim.pending[i].fd);
-		return;
-	}
+	flush_keys();
 
-	for (size_t i = 0; i < arg->size; i++){
-		if (arg->ptr[i].type != MSGPACK_OBJECT_STR)
-			continue;
+	const char mouse_cmd[] = "nvim_input_mouse";
+	nvim_request_str(mouse_cmd, sizeof(mouse_cmd) - 1);
+	pack_mouse_args(button, action, mod, grid, row, col);
+}
 
-		fprintf(fout, "%.*s\n", arg->ptr[i].via.str.size, arg->ptr[i].via.str.ptr);
-	}
+/* at most this many wheel ticks go out in one event loop iteration (and in
+ * one atomic call), the rest stays pending for the next ones - a fast wheel
+ * or touchpad fling is spread out over a few iterations rather than having
+ * nvim scroll for everything the display queued up at once */
+#define MOUSE_WHEEL_MAX 8
 
-	fclose(fout);
-}
+/* send the pending drag, or up to MOUSE_WHEEL_MAX of the pending wheel ticks,
+ * false if there is nothing left pending after */
+static bool flush_mouse_batch(struct nvim_meta* m)
+{
+	if (m->mouse.kind == MOUSE_NONE)
+		return false;
 
-/*
- * api complains when we attempt to do this, might be some other way
- */
-static void request_buffer_contents(int fd)
-{
-/* some optimization opportunity here by checking if there exists more pending
- * transfers that are at pos 0 and re-using the same request on them. */
-	size_t i = 0;
-	for (; i < COUNT_OF(nvim.pending); i++){
-		if (nvim.pending[i].fd <= 0){
-			nvim.pending[i].fd = fd;
-			nvim.pending[i].pos = 0;
-			nvim.pending[i].data = handle_buffer_response;
-			break;
+	size_t n = m->mouse.count < MOUSE_WHEEL_MAX ? m->mouse.count : MOUSE_WHEEL_MAX;
+
+/* a run of wheel ticks goes out as a single atomic call, there is no way of
+ * providing a repeat count to nvim_input_mouse itself - so nvim still
+ * scrolls once per tick, only the requests are saved */
+	if (n > 1){
+		flush_keys();
+
+		const char cmd[] = "nvim_call_atomic";
+		const char mouse_cmd[] = "nvim_input_mouse";
+		nvim_request_str(cmd, sizeof(cmd) - 1);
+		msgpack_pack_array(nvim.out, 1);
+		msgpack_pack_array(nvim.out, n);
+
+		for (size_t i = 0; i < n; i++){
+			msgpack_pack_array(nvim.out, 2);
+			msgpack_pack_str(nvim.out, sizeof(mouse_cmd) - 1);
+			msgpack_pack_str_body(nvim.out, mouse_cmd, sizeof(mouse_cmd) - 1);
+			pack_mouse_args(m->mouse.button, m->mouse.action,
+				"", m->grid_id, m->mouse.row, m->mouse.col);
 		}
-	}
 
-	if (i == COUNT_OF(nvim.pending)){
-		close(fd);
-		return;
+		metric_add(&nvim.stats.mouse_requests_saved, n - 1);
 	}
+	else
+		build_mouse_packet(m->mouse.button,
+			m->mouse.action, "", m->grid_id, m->mouse.row, m->mouse.col);
 
-	const char lines_cmd[] = "nvim_buf_get_lines";
-	uint32_t id = nvim_request_str(lines_cmd, sizeof(lines_cmd) - 1);
-	msgpack_pack_array(nvim.out, 4);
-	msgpack_pack_int(nvim.out, 0); /* buffer */
-	msgpack_pack_int(nvim.out, 0); /* start */
-	msgpack_pack_int(nvim.out, -1); /* end */
-	msgpack_pack_int(nvim.out, 0); /* overflow? */
-	nvim.pending[i].reqid = id;
+	m->mouse.count -= n;
+	if (!m->mouse.count)
+		m->mouse.kind = MOUSE_NONE;
+
+	return m->mouse.kind != MOUSE_NONE;
 }
 
-static void on_mouse_button(struct tui_context* c,
-	int last_x, int last_y, int button, bool active, int modifiers, void* t)
+/* all of it, other input is about to go out and has to come after */
+static void flush_mouse(struct nvim_meta* m)
 {
-	trace("mouse_btn(%d:%d, mods:%d, index: %d");
-	struct nvim_meta* m = t;
+	while (flush_mouse_batch(m)){}
+}
 
-/* don't consider release for wheel action */
-	if (!active && button >= TUIBTN_WHEEL_UP)
-		return;
+static void flush_mice()
+{
+	size_t pos = 0;
+	struct nvim_meta* m;
+	while ((m = grids_next(&pos)))
+		flush_mouse(m);
+}
 
-	const char* action, (* btn);
+/* everything from the tui input callbacks that is held back for merging */
+static void flush_input()
+{
+	flush_mice();
+	flush_keys();
+}
 
-	/* 1: {button} */
-	bool wheel = false;
-	switch(button){
-	case TUIBTN_LEFT:
-		btn = "left";
-	break;
-	case TUIBTN_RIGHT:
-		btn = "right";
-	break;
-	case TUIBTN_MIDDLE:
-		btn = "middle";
-	break;
-	case TUIBTN_WHEEL_UP:
-	case TUIBTN_WHEEL_DOWN:
-	default:
-		wheel = true;
-		btn = "wheel";
-	break;
-	}
+/* the end of an event loop iteration: the same, except that only one batch
+ * of wheel ticks per grid goes out - true if some are left for the next */
+static bool flush_input_paced()
+{
+	size_t pos = 0;
+	struct nvim_meta* m;
+	bool pending = false;
+	while ((m = grids_next(&pos)))
+		pending |= flush_mouse_batch(m);
+
+	flush_keys();
+	return pending;
+}
 
-/* 2: {action} */
-	if (wheel){
-		if (button == TUIBTN_WHEEL_UP){
-			action = "up";
-		}
-		else {
-			action = "down";
-		}
+static void queue_mouse(struct nvim_meta* m, enum mouse_kind kind,
+	const char* button, const char* action, int row, int col)
+{
+/* to keep the order intact, only one kind of input is ever pending */
+	flush_keys();
+	size_t pos = 0;
+	struct nvim_meta* other;
+	while ((other = grids_next(&pos))){
+		if (other != m)
+			flush_mouse(other);
 	}
-	else if (active){
-		action = "press";
-		m->button_mask |= 1 << TUIBTN_LEFT;
+
+	if (m->mouse.kind == kind &&
+		m->mouse.button == button && m->mouse.action == action){
+		if (kind == MOUSE_DRAG)
+			metric_add(&nvim.stats.mouse_dropped, 1);
+		else
+			m->mouse.count++;
 	}
 	else {
-		m->button_mask &= ~(1 << TUIBTN_LEFT);
-		action = "release";
+		flush_mouse(m);
+		m->mouse.kind = kind;
+		m->mouse.button = button;
+		m->mouse.action = action;
+		m->mouse.count = 1;
 	}
 
-/* modifier to button follows same rule as for normal input,
- * i.e. C-A (though not as <Ca> */
-
-	build_mouse_packet(btn, action, "", m->grid_id, last_y, last_x);
+	m->mouse.row = row;
+	m->mouse.col = col;
 }
 
-static void on_mouse(struct tui_context* c,
-	bool relative, int x, int y, int modifiers, void* t)
+/*
+ * Direct transfers: nvim runs as our child with the same credentials, so it
+ * can open a bchunk fd of ours through /proc and read or write the file
+ * itself. Nothing then goes through the rpc channel, at the price of nvim
+ * being busy with the whole file in one go - so by default (auto) this is
+ * only done for regular files, where that is quick, and pipes are streamed.
+ * If nvim can't do it the transfer falls back to streaming.
+ */
+static bool transfer_direct(int fd)
 {
-	struct nvim_meta* m = t;
-	if (!m->button_mask || relative)
-		return;
-
-	const char* btn = "left";
-	if (TUIBTN_LEFT & m->button_mask)
-		btn = "left";
-	else if (TUIBTN_RIGHT & m->button_mask)
-		btn = "right";
-	else if (TUIBTN_MIDDLE & m->button_mask)
-		btn = "middle";
-	else
-		return;
+	if (nvim.transfer != TRANSFER_AUTO)
+		return nvim.transfer == TRANSFER_DIRECT;
 
-	build_mouse_packet(btn, "drag", "", m->grid_id, y, x);
+	struct stat st;
+	return 0 == fstat(fd, &st) && S_ISREG(st.st_mode);
 }
 
-static void on_key(struct tui_context* c, uint32_t ksym,
-	uint8_t scancode, uint16_t mods, uint16_t subid, void* t)
+/* [fmt] has one %s for the path of [fd] as seen from nvim */
+static void transfer_command(
+	const char* fmt, int fd, rpc_done done, void* tag)
 {
-	trace("unknown_key(%"PRIu32",%"PRIu8",%"PRIu16")", ksym, scancode, subid);
+	char path[64];
+	char cmd[256];
+	snprintf(path, sizeof(path), "/proc/%d/fd/%d", (int) getpid(), fd);
+	int len = snprintf(cmd, sizeof(cmd), fmt, path);
 
-	char str[16];
-	size_t ofs = 0;
+	const char method[] = "nvim_command";
+	rpc_request(method, sizeof(method) - 1, done, tag);
+	msgpack_pack_array(nvim.out, 1);
+	msgpack_pack_str(nvim.out, len);
+	msgpack_pack_str_body(nvim.out, cmd, len);
+}
 
-	str[ofs++] = '<';
+/*
+ * Buffer exports (bchunk out) are streamed: nvim is asked for EXPORT_CHUNK
+ * lines at a time and the next range is requested as soon as the previous
+ * one has arrived, so at most one chunk is being written while the next is
+ * on its way - a huge buffer neither stalls nvim with one giant response nor
+ * has to be held in memory as a whole.
+ *
+ * The responses arrive on the input thread, which doesn't copy the lines:
+ * the callback takes over the read buffer and zone the response was
+ * unpacked into (reader_claim), the lines are joined in place in that
+ * buffer by whoever writes them (export_data_join). The main loop (export_pump) sends the requests, updates the progress
+ * shown on the primary window and hands each chunk to the writer thread
+ * (thread_export). That one owns the fds while it has a chunk and polls the
+ * destinations that are full, so a slow reader - or a slow filesystem, where
+ * O_NONBLOCK does nothing - holds up neither redraws nor input. Without a
+ * writer thread (single-threaded) export_pump does the writes.
+ */
+#define EXPORT_CHUNK 10000
+#define EXPORT_FDS 8
+
+static bool reader_claim(uint8_t** buf, msgpack_zone** zone);
+
+/* a nvim_buf_get_lines response as it was unpacked, [lines] live in [zone]
+ * and their strings point into [buf] - until they are joined there */
+struct export_data {
+	uint8_t* buf;
+	msgpack_zone* zone;
+	const msgpack_object* lines;
+	size_t n_lines;
+	bool joined;
+	size_t len;
+};
+
+struct export {
+/* set by the response callbacks while [requested], covered by
+ * nvim.exports.lock - as is [writing] */
+	bool requested;
+	bool failed;
+	bool direct;
+	int64_t buffer;
+	uint64_t total;
+	struct export_data* chunk;
+
+/* the writer thread has the job, [fds], [ofs] and [data] are its until it
+ * clears this (and frees [data]) - the rest is only touched by the main loop */
+	bool writing;
+	struct export* queue_next;
+
+/* exports started before the first chunk arrived share the job, each
+ * destination is at its own [ofs] into the chunk being written */
+	int fds[EXPORT_FDS];
+	size_t ofs[EXPORT_FDS];
+	size_t n_fds;
+	struct export_data* data;
+
+	uint64_t lines;
+	bool last;
+
+	struct export* next;
+};
+
+static void export_data_free(struct export_data* data)
+{
+	if (!data)
+		return;
+
+	if (data->zone)
+		msgpack_zone_free(data->zone);
+	free(data->buf);
+	free(data);
+}
+
+/* [[bufnr, line count], error] from the nvim_call_atomic in export_resolve */
+static void export_resolved(void* tag,
+	const msgpack_object* error, const msgpack_object* result)
+{
+	struct export* job = tag;
+	const msgpack_object_array* res = NULL;
+
+	if (!error && result && result->type == MSGPACK_OBJECT_ARRAY &&
+		result->via.array.size == 2 &&
+		result->via.array.ptr[0].type == MSGPACK_OBJECT_ARRAY &&
+		result->via.array.ptr[0].via.array.size == 2)
+		res = &result->via.array.ptr[0].via.array;
+
+	pthread_mutex_lock(&nvim.exports.lock);
+	if (res && res->ptr[0].type == MSGPACK_OBJECT_POSITIVE_INTEGER &&
+		res->ptr[1].type == MSGPACK_OBJECT_POSITIVE_INTEGER){
+		job->buffer = res->ptr[0].via.u64;
+		job->total = res->ptr[1].via.u64;
+	}
+	else
+		job->failed = true;
+	job->requested = false;
+	pthread_mutex_unlock(&nvim.exports.lock);
+
+	if (!nvim.single_thread)
+		wake_render();
+}
+
+static void export_chunk(void* tag,
+	const msgpack_object* error, const msgpack_object* result)
+{
+	struct export* job = tag;
+	struct export_data* data = NULL;
+	bool valid = !error && result && result->type == MSGPACK_OBJECT_ARRAY;
+
+	for (size_t i = 0; valid && i < result->via.array.size; i++)
+		valid = result->via.array.ptr[i].type == MSGPACK_OBJECT_STR;
+
+	if (valid && (data = malloc(sizeof(struct export_data)))){
+		*data = (struct export_data){
+			.lines = result->via.array.ptr,
+			.n_lines = result->via.array.size
+		};
+
+		if (!reader_claim(&data->buf, &data->zone)){
+			free(data);
+			data = NULL;
+		}
+	}
+
+	pthread_mutex_lock(&nvim.exports.lock);
+	if (!data)
+		job->failed = true;
+	job->chunk = data;
+	job->requested = false;
+	pthread_mutex_unlock(&nvim.exports.lock);
+
+	if (!nvim.single_thread)
+		wake_render();
+}
+
+/* nvim has written the file itself, or couldn't and it has to be streamed */
+static void export_direct_done(void* tag,
+	const msgpack_object* error, const msgpack_object* result)
+{
+	struct export* job = tag;
+
+	pthread_mutex_lock(&nvim.exports.lock);
+	if (!result)
+		job->failed = true;
+	else if (!error)
+		job->last = true;
+	job->direct = false;
+	job->requested = false;
+	pthread_mutex_unlock(&nvim.exports.lock);
+
+	if (!nvim.single_thread)
+		wake_render();
+}
+
+static void export_request(struct export* job)
+{
+	const char lines_cmd[] = "nvim_buf_get_lines";
+	job->requested = true;
+	rpc_request(lines_cmd, sizeof(lines_cmd) - 1, export_chunk, job);
+	msgpack_pack_array(nvim.out, 4);
+	msgpack_pack_int64(nvim.out, job->buffer);
+	msgpack_pack_uint64(nvim.out, job->lines);
+	msgpack_pack_uint64(nvim.out, job->lines + EXPORT_CHUNK);
+	msgpack_pack_false(nvim.out); /* strict indexing */
+}
+
+static void export_resolve(struct export* job)
+{
+/* the buffer is pinned by number as the current one could change between
+ * chunks, the line count is only used for the progress */
+	const char cmd[] = "nvim_call_atomic";
+	const char call[] = "nvim_call_function";
+	const char count[] = "nvim_buf_line_count";
+
+	job->requested = true;
+	rpc_request(cmd, sizeof(cmd) - 1, export_resolved, job);
+	msgpack_pack_array(nvim.out, 1);
+	msgpack_pack_array(nvim.out, 2);
+
+	msgpack_pack_array(nvim.out, 2);
+	msgpack_pack_str(nvim.out, sizeof(call) - 1);
+	msgpack_pack_str_body(nvim.out, call, sizeof(call) - 1);
+	msgpack_pack_array(nvim.out, 2);
+	msgpack_pack_str(nvim.out, 5);
+	msgpack_pack_str_body(nvim.out, "bufnr", 5);
+	msgpack_pack_array(nvim.out, 1);
+	msgpack_pack_str(nvim.out, 1);
+	msgpack_pack_str_body(nvim.out, "%", 1);
+
+	msgpack_pack_array(nvim.out, 2);
+	msgpack_pack_str(nvim.out, sizeof(count) - 1);
+	msgpack_pack_str_body(nvim.out, count, sizeof(count) - 1);
+	msgpack_pack_array(nvim.out, 1);
+	msgpack_pack_int(nvim.out, 0);
+}
+
+/* join the lines in the buffer they arrived in, each followed by a newline:
+ * every string has a header of at least one byte in front of it, so the
+ * result never overtakes what is still to be moved */
+static void export_data_join(struct export_data* data)
+{
+	uint8_t* dst = data->buf;
+
+	for (size_t i = 0; i < data->n_lines; i++){
+		const msgpack_object_str* str = &data->lines[i].via.str;
+		memmove(dst, str->ptr, str->size);
+		dst += str->size;
+		*dst++ = '\n';
+	}
+
+	data->len = dst - data->buf;
+	data->joined = true;
+}
+
+/* write as much of the chunk as every fd takes without blocking, true when
+ * all of it is out (or there is no one left to write to) */
+static bool export_write(struct export* job)
+{
+	bool done = true;
+
+	if (!job->data->joined)
+		export_data_join(job->data);
+
+	for (size_t i = 0; i < job->n_fds; i++){
+		while (-1 != job->fds[i] && job->ofs[i] < job->data->len){
+			ssize_t nw = write(job->fds[i],
+				&job->data->buf[job->ofs[i]], job->data->len - job->ofs[i]);
+
+			if (nw > 0){
+				job->ofs[i] += nw;
+				continue;
+			}
+
+			if (-1 == nw && errno == EINTR)
+				continue;
+
+			if (-1 == nw && errno == EAGAIN){
+				done = false;
+				break;
+			}
+
+			trace("export: write error: %d", errno);
+			close(job->fds[i]);
+			job->fds[i] = -1;
+			atomic_fetch_sub(&nvim.stats.transfers, 1);
+		}
+	}
+
+	return done;
+}
+
+/*
+ * writer thread: picks up the jobs export_pump queues, writes their chunk
+ * and polls the destinations that are full until all of it is out, then
+ * gives the job back to the main loop
+ */
+static void* thread_export(void* arg)
+{
+	struct export* active = NULL;
+	struct pollfd* set = NULL;
+	size_t set_cap = 0;
+
+	for (;;){
+		pthread_mutex_lock(&nvim.exports.lock);
+		bool quit = nvim.exports.quit;
+		while (nvim.exports.queue){
+			struct export* job = nvim.exports.queue;
+			nvim.exports.queue = job->queue_next;
+			job->queue_next = active;
+			active = job;
+		}
+		pthread_mutex_unlock(&nvim.exports.lock);
+
+		if (quit)
+			break;
+
+		size_t n = 1;
+		for (struct export** prev = &active; *prev;){
+			struct export* job = *prev;
+			if (!export_write(job)){
+				n += job->n_fds;
+				prev = &job->queue_next;
+				continue;
+			}
+
+			*prev = job->queue_next;
+			export_data_free(job->data);
+			job->data = NULL;
+
+			pthread_mutex_lock(&nvim.exports.lock);
+			job->writing = false;
+			pthread_mutex_unlock(&nvim.exports.lock);
+			wake_render();
+		}
+
+		if (n > set_cap){
+			struct pollfd* new_set = realloc(set, n * sizeof(struct pollfd));
+			if (!new_set){
+				nanosleep(&(struct timespec){.tv_nsec = 10000000}, NULL);
+				continue;
+			}
+			set = new_set;
+			set_cap = n;
+		}
+
+		set[0] = (struct pollfd){.fd = nvim.exports.wakeup, .events = POLLIN};
+		n = 1;
+		for (struct export* job = active; job; job = job->queue_next){
+			for (size_t i = 0; i < job->n_fds; i++){
+				if (-1 != job->fds[i] && job->ofs[i] < job->data->len)
+					set[n++] = (struct pollfd){.fd = job->fds[i], .events = POLLOUT};
+			}
+		}
+
+		if (-1 == poll(set, n, -1) && errno != EINTR){
+			trace("export: poll error: %d", errno);
+			nanosleep(&(struct timespec){.tv_nsec = 10000000}, NULL);
+		}
+
+		if (set[0].revents & POLLIN){
+			uint64_t val;
+			read(nvim.exports.wakeup, &val, sizeof(val));
+		}
+	}
+
+	free(set);
+	return NULL;
+}
+
+/* on the first export, if it fails export_pump does the writes instead */
+static void export_writer_start()
+{
+	if (nvim.single_thread || nvim.exports.writer_running)
+		return;
+
+	nvim.exports.wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (-1 == nvim.exports.wakeup)
+		return;
+
+	if (0 != pthread_create(&nvim.exports.writer, NULL, thread_export, NULL)){
+		close(nvim.exports.wakeup);
+		nvim.exports.wakeup = -1;
+		return;
+	}
+
+	nvim.exports.writer_running = true;
+}
+
+static void export_finish(struct export* job)
+{
+	trace("export: %"PRIu64" lines%s", job->lines, job->failed ? ", failed" : "");
+
+	for (size_t i = 0; i < job->n_fds; i++){
+		if (-1 == job->fds[i])
+			continue;
+
+		close(job->fds[i]);
+		atomic_fetch_sub(&nvim.stats.transfers, 1);
+	}
+
+	export_data_free(job->chunk);
+	export_data_free(job->data);
+	free(job);
+	arcan_tui_progress(nvim.tui, TUI_PROGRESS_BCHUNK_OUT, 1.0);
+}
+
+/*
+ * [job] has just resolved its buffer, if another export of the same buffer
+ * hasn't had anything handed over for writing yet its destinations are
+ * moved there. Each export resolves on its own, so one that was asked for
+ * after switching buffers never gets the contents of the previous one.
+ * An empty buffer is handed over as one chunk without lines, so [lines]
+ * alone doesn't tell - [last] and [writing] are set by then.
+ */
+static bool export_merge(struct export* job)
+{
+	for (struct export* into = nvim.exports.list; into; into = into->next){
+		if (into == job || into->buffer != job->buffer || into->lines ||
+			into->last || into->data || into->n_fds + job->n_fds > EXPORT_FDS)
+			continue;
+
+		pthread_mutex_lock(&nvim.exports.lock);
+		bool fresh = !into->failed && !into->direct && !into->writing;
+		pthread_mutex_unlock(&nvim.exports.lock);
+
+		if (!fresh)
+			continue;
+
+		for (size_t i = 0; i < job->n_fds; i++){
+			into->ofs[into->n_fds] = 0;
+			into->fds[into->n_fds++] = job->fds[i];
+		}
+		return true;
+	}
+
+	return false;
+}
+
+/*
+ * main loop, move every export along: pass what has arrived on to be
+ * written, request the next chunk and drop jobs that are complete or
+ * failed. Returns true if export_pump is doing the writes itself and some
+ * destination has to drain first.
+ */
+static bool export_pump()
+{
+	bool blocked = false;
+	struct export** prev = &nvim.exports.list;
+
+	while (*prev){
+		struct export* job = *prev;
+
+/* while a request is outstanding its callback owns the shared fields, once
+ * it is done they are the main loop's until the next request */
+		pthread_mutex_lock(&nvim.exports.lock);
+		bool requested = job->requested;
+		bool writing = job->writing;
+		pthread_mutex_unlock(&nvim.exports.lock);
+
+/* the previous chunk is out, move on to the one that has arrived */
+		if (!requested && !writing && !job->data && job->chunk){
+			job->data = job->chunk;
+			job->chunk = NULL;
+			job->lines += job->data->n_lines;
+			job->last = job->data->n_lines < EXPORT_CHUNK;
+			for (size_t i = 0; i < job->n_fds; i++)
+				job->ofs[i] = 0;
+
+			if (nvim.exports.writer_running){
+				pthread_mutex_lock(&nvim.exports.lock);
+				job->writing = writing = true;
+				job->queue_next = nvim.exports.queue;
+				nvim.exports.queue = job;
+				pthread_mutex_unlock(&nvim.exports.lock);
+
+				uint64_t val = 1;
+				write(nvim.exports.wakeup, &val, sizeof(val));
+			}
+		}
+
+		if (!nvim.exports.writer_running && job->data){
+			if (export_write(job)){
+				export_data_free(job->data);
+				job->data = NULL;
+			}
+			else
+				blocked = true;
+		}
+
+		if (requested){
+			prev = &job->next;
+			continue;
+		}
+
+		if (!writing && !job->data){
+			bool alive = false;
+			for (size_t i = 0; i < job->n_fds && !alive; i++)
+				alive = -1 != job->fds[i];
+
+			if (job->failed || job->last || !alive){
+				*prev = job->next;
+				export_finish(job);
+				continue;
+			}
+		}
+
+/* one chunk ahead of what is being written, no more */
+		if (job->chunk || job->last || job->failed){
+			prev = &job->next;
+			continue;
+		}
+
+		if (-1 == job->buffer)
+			export_resolve(job);
+		else if (!job->lines && export_merge(job)){
+			*prev = job->next;
+			free(job);
+			continue;
+		}
+		else {
+			if (job->total)
+				arcan_tui_progress(nvim.tui, TUI_PROGRESS_BCHUNK_OUT,
+					(float) job->lines / (float) job->total);
+			export_request(job);
+		}
+
+		prev = &job->next;
+	}
+
+	return blocked;
+}
+
+/* drop every export, what has been written so far stays written - the
+ * writer thread finishes the write it is in first */
+static void export_cancel()
+{
+	if (nvim.exports.writer_running){
+		pthread_mutex_lock(&nvim.exports.lock);
+		nvim.exports.quit = true;
+		pthread_mutex_unlock(&nvim.exports.lock);
+
+		uint64_t val = 1;
+		write(nvim.exports.wakeup, &val, sizeof(val));
+		pthread_join(nvim.exports.writer, NULL);
+
+		close(nvim.exports.wakeup);
+		nvim.exports.wakeup = -1;
+		nvim.exports.writer_running = false;
+	}
+
+	while (nvim.exports.list){
+		struct export* job = nvim.exports.list;
+		nvim.exports.list = job->next;
+		job->failed = true;
+		export_finish(job);
+	}
+}
+
+static void export_start(int fd)
+{
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	atomic_fetch_add(&nvim.stats.transfers, 1);
+	export_writer_start();
+
+	struct export* job = malloc(sizeof(struct export));
+	if (!job){
+		atomic_fetch_sub(&nvim.stats.transfers, 1);
+		close(fd);
+		return;
+	}
+
+	*job = (struct export){
+		.buffer = -1,
+		.fds = {fd},
+		.n_fds = 1,
+		.next = nvim.exports.list
+	};
+	nvim.exports.list = job;
+
+	if (transfer_direct(fd)){
+		job->requested = true;
+		job->direct = true;
+		transfer_command(
+			"call writefile(getbufline(bufnr('%%'), 1, '$'), '%s')",
+			fd, export_direct_done, job);
+	}
+	else
+		export_resolve(job);
+}
+
+/*
+ * Imports (bchunk in) go into a new buffer, IMPORT_LINES lines or
+ * IMPORT_BYTES bytes at a time through nvim_buf_set_lines, and like with
+ * exports the next batch is only sent once nvim has answered the previous
+ * one. The input is read into a fixed buffer, so the memory used doesn't
+ * depend on the size of the input - a line longer than that goes out in
+ * pieces, each appended to the end of the last line with nvim_buf_set_text.
+ * Regular files are read with pread from where the last read ended rather
+ * than mapped: the sender shares the file, and if it truncates it while we
+ * read, a mapping would fault (SIGBUS) where pread just returns less - which
+ * is then treated as the end of the input. The file offset is shared with
+ * the sender as well, hence pread.
+ */
+#define IMPORT_LINES 10000
+#define IMPORT_BYTES (1024 * 1024)
+
+struct import {
+/* set by the response callbacks while [requested], nvim.imports.lock */
+	bool requested;
+	bool failed;
+	int64_t buffer;
+
+/* nvim has been asked to read the fd itself, [done] once it has */
+	bool direct;
+	bool done;
+
+	int fd;
+	uint64_t size;
+	uint64_t consumed;
+	uint64_t lines;
+	bool eof;
+
+/* regular file: read at [offset] with pread, anything else with read */
+	bool positional;
+	uint64_t offset;
+
+/* the read buffer of IMPORT_BYTES, [pos] to [end] is what is left to send */
+	uint8_t* data;
+	size_t pos, end;
+
+/* the last line sent was cut at the end of a full read buffer, its first
+ * [open_len] bytes are in the buffer and the rest is still to come */
+	bool open;
+	uint64_t open_len;
+
+	struct import* next;
+};
+
+/* [[nil, bufnr], error] from the nvim_call_atomic in import_resolve */
+static void import_resolved(void* tag,
+	const msgpack_object* error, const msgpack_object* result)
+{
+	struct import* job = tag;
+	const msgpack_object_array* res = NULL;
+
+	if (!error && result && result->type == MSGPACK_OBJECT_ARRAY &&
+		result->via.array.size == 2 &&
+		result->via.array.ptr[1].type == MSGPACK_OBJECT_NIL &&
+		result->via.array.ptr[0].type == MSGPACK_OBJECT_ARRAY &&
+		result->via.array.ptr[0].via.array.size == 2)
+		res = &result->via.array.ptr[0].via.array;
+
+	pthread_mutex_lock(&nvim.imports.lock);
+	if (res && res->ptr[1].type == MSGPACK_OBJECT_POSITIVE_INTEGER)
+		job->buffer = res->ptr[1].via.u64;
+	else
+		job->failed = true;
+	job->requested = false;
+	pthread_mutex_unlock(&nvim.imports.lock);
+
+	if (!nvim.single_thread)
+		wake_render();
+}
+
+static void import_direct_done(void* tag,
+	const msgpack_object* error, const msgpack_object* result)
+{
+	struct import* job = tag;
+
+	pthread_mutex_lock(&nvim.imports.lock);
+	if (!result)
+		job->failed = true;
+	else if (!error)
+		job->done = true;
+	job->direct = false;
+	job->requested = false;
+	pthread_mutex_unlock(&nvim.imports.lock);
+
+	if (!nvim.single_thread)
+		wake_render();
+}
+
+static void import_batch_done(void* tag,
+	const msgpack_object* error, const msgpack_object* result)
+{
+	struct import* job = tag;
+
+	pthread_mutex_lock(&nvim.imports.lock);
+	if (error || !result)
+		job->failed = true;
+	job->requested = false;
+	pthread_mutex_unlock(&nvim.imports.lock);
+
+	if (!nvim.single_thread)
+		wake_render();
+}
+
+static void import_resolve(struct import* job)
+{
+/* the buffer is pinned by number, the batches go there even if the user
+ * switches away from it in the meantime */
+	const char cmd[] = "nvim_call_atomic";
+	const char command[] = "nvim_command";
+	const char call[] = "nvim_call_function";
+
+	job->requested = true;
+	rpc_request(cmd, sizeof(cmd) - 1, import_resolved, job);
+	msgpack_pack_array(nvim.out, 1);
+	msgpack_pack_array(nvim.out, 2);
+
+	msgpack_pack_array(nvim.out, 2);
+	msgpack_pack_str(nvim.out, sizeof(command) - 1);
+	msgpack_pack_str_body(nvim.out, command, sizeof(command) - 1);
+	msgpack_pack_array(nvim.out, 1);
+	msgpack_pack_str(nvim.out, 4);
+	msgpack_pack_str_body(nvim.out, "enew", 4);
+
+	msgpack_pack_array(nvim.out, 2);
+	msgpack_pack_str(nvim.out, sizeof(call) - 1);
+	msgpack_pack_str_body(nvim.out, call, sizeof(call) - 1);
+	msgpack_pack_array(nvim.out, 2);
+	msgpack_pack_str(nvim.out, 5);
+	msgpack_pack_str_body(nvim.out, "bufnr", 5);
+	msgpack_pack_array(nvim.out, 1);
+	msgpack_pack_str(nvim.out, 1);
+	msgpack_pack_str_body(nvim.out, "%", 1);
+}
+
+/* top up the read buffer, false if there is nothing new and no eof yet */
+static bool import_read(struct import* job)
+{
+	if (job->pos){
+		memmove(job->data, &job->data[job->pos], job->end - job->pos);
+		job->end -= job->pos;
+		job->pos = 0;
+	}
+
+	if (job->eof)
+		return true;
+
+	bool got = false;
+	while (!job->eof && job->end < IMPORT_BYTES){
+		ssize_t nr = job->positional ?
+			pread(job->fd, &job->data[job->end], IMPORT_BYTES - job->end, job->offset) :
+			read(job->fd, &job->data[job->end], IMPORT_BYTES - job->end);
+		if (nr > 0){
+			job->end += nr;
+			job->offset += nr;
+			got = true;
+		}
+		else if (0 == nr){
+			if (job->positional && job->offset < job->size)
+				trace("import: truncated to %"PRIu64" of %"PRIu64" bytes",
+					job->offset, job->size);
+			job->eof = true;
+			got = true;
+		}
+		else if (errno != EINTR){
+			if (errno != EAGAIN){
+				trace("import: read error: %d", errno);
+				job->failed = true;
+				got = true;
+			}
+			break;
+		}
+	}
+
+	return got;
+}
+
+/*
+ * pack the next batch of lines from [pos] as nvim_buf_set_lines, the first
+ * one replaces the empty line of the new buffer. Only complete lines go out
+ * before eof, unless a single line fills the whole read buffer - then that
+ * part of it is sent and the line is left [open]. While a line is open the
+ * batch goes out as nvim_buf_set_text instead, which appends the first line
+ * of the batch to it rather than starting a new one.
+ */
+static void import_send(struct import* job)
+{
+	const uint8_t* start = &job->data[job->pos];
+	const uint8_t* end = &job->data[job->end];
+	size_t n = 0;
+	bool partial = false;
+
+	const uint8_t* cur = start;
+	while (n < IMPORT_LINES && cur < end){
+		const uint8_t* nl = memchr(cur, '\n', end - cur);
+		if (!nl){
+			if (job->eof || (cur == start && job->end - job->pos == IMPORT_BYTES)){
+				n++;
+				cur = end;
+				partial = !job->eof;
+			}
+			break;
+		}
+		n++;
+		cur = nl + 1;
+	}
+
+	if (!n)
+		return;
+
+	job->requested = true;
+	if (job->open){
+		const char cmd[] = "nvim_buf_set_text";
+		rpc_request(cmd, sizeof(cmd) - 1, import_batch_done, job);
+		msgpack_pack_array(nvim.out, 6);
+		msgpack_pack_int64(nvim.out, job->buffer);
+		msgpack_pack_uint64(nvim.out, job->lines - 1);
+		msgpack_pack_uint64(nvim.out, job->open_len);
+		msgpack_pack_uint64(nvim.out, job->lines - 1);
+		msgpack_pack_uint64(nvim.out, job->open_len);
+	}
+	else {
+		const char cmd[] = "nvim_buf_set_lines";
+		rpc_request(cmd, sizeof(cmd) - 1, import_batch_done, job);
+		msgpack_pack_array(nvim.out, 5);
+		msgpack_pack_int64(nvim.out, job->buffer);
+		msgpack_pack_int(nvim.out, job->lines ? -1 : 0);
+		msgpack_pack_int(nvim.out, -1);
+		msgpack_pack_false(nvim.out);
+	}
+	msgpack_pack_array(nvim.out, n);
+
+	size_t len = 0;
+	for (const uint8_t* line = start; line < cur;){
+		const uint8_t* nl = memchr(line, '\n', cur - line);
+		len = nl ? (size_t)(nl - line) : (size_t)(cur - line);
+		msgpack_pack_str(nvim.out, len);
+		msgpack_pack_str_body(nvim.out, line, len);
+		line += len + (nl ? 1 : 0);
+	}
+
+/* the first line of a set_text batch is the open one, not a new one */
+	job->lines += job->open ? n - 1 : n;
+	job->open_len = job->open && n == 1 ? job->open_len + len : len;
+	job->open = partial;
+
+	job->consumed += cur - start;
+	job->pos += cur - start;
+}
+
+static void import_finish(struct import* job)
+{
+	if (job->done)
+		trace("import: read by nvim");
+	else
+		trace("import: %"PRIu64" lines, %"PRIu64" bytes%s",
+			job->lines, job->consumed, job->failed ? ", failed" : "");
+
+	free(job->data);
+	close(job->fd);
+	free(job);
+	atomic_fetch_sub(&nvim.stats.transfers, 1);
+	arcan_tui_progress(nvim.tui, TUI_PROGRESS_BCHUNK_IN, 1.0);
+}
+
+/*
+ * main loop, send the next batch of every import that isn't waiting for a
+ * response. Returns true if some import is waiting for more data to read,
+ * the source fds aren't part of the set so this is polled.
+ */
+static bool import_pump()
+{
+	bool blocked = false;
+	struct import** prev = &nvim.imports.list;
+
+	while (*prev){
+		struct import* job = *prev;
+
+		pthread_mutex_lock(&nvim.imports.lock);
+		bool requested = job->requested;
+		pthread_mutex_unlock(&nvim.imports.lock);
+
+		if (requested){
+			prev = &job->next;
+			continue;
+		}
+
+		if (job->failed || job->done){
+			*prev = job->next;
+			import_finish(job);
+			continue;
+		}
+
+/* nvim couldn't read it directly, stream instead */
+		if (-1 == job->buffer){
+			import_resolve(job);
+			prev = &job->next;
+			continue;
+		}
+
+		if (!import_read(job))
+			blocked = true;
+
+		if (!job->failed)
+			import_send(job);
+
+		if (job->failed || (!job->requested && job->eof && job->pos == job->end)){
+			*prev = job->next;
+			import_finish(job);
+			continue;
+		}
+
+		if (job->requested && job->size)
+			arcan_tui_progress(nvim.tui, TUI_PROGRESS_BCHUNK_IN,
+				(float) job->consumed / (float) job->size);
+
+		prev = &job->next;
+	}
+
+	return blocked;
+}
+
+static void import_cancel()
+{
+	while (nvim.imports.list){
+		struct import* job = nvim.imports.list;
+		nvim.imports.list = job->next;
+		job->failed = true;
+		import_finish(job);
+	}
+}
+
+/* [size] is what the other end said it would send, 0 if unknown */
+static void import_start(int fd, uint64_t size)
+{
+	struct import* job = malloc(sizeof(struct import));
+	if (!job){
+		close(fd);
+		return;
+	}
+
+	*job = (struct import){
+		.buffer = -1,
+		.fd = fd,
+		.size = size
+	};
+
+	job->data = malloc(IMPORT_BYTES);
+	if (!job->data){
+		free(job);
+		close(fd);
+		return;
+	}
+
+/* O_NONBLOCK does nothing for a regular file, the reads are bounded anyway */
+	struct stat st;
+	if (0 == fstat(fd, &st) && S_ISREG(st.st_mode)){
+		job->positional = true;
+		if (st.st_size > 0)
+			job->size = st.st_size;
+	}
+	else
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	atomic_fetch_add(&nvim.stats.transfers, 1);
+	job->next = nvim.imports.list;
+	nvim.imports.list = job;
+
+	if (transfer_direct(fd)){
+		job->requested = true;
+		job->direct = true;
+		transfer_command("enew | silent read %s | 1delete _",
+			fd, import_direct_done, job);
+	}
+	else
+		import_resolve(job);
+}
+
+/*
+ * the contexts for the next arcan_tui_process, leaving out grids that don't
+ * have their subwindow yet. The tui library takes at most TUI_PROCESS_MAX at
+ * once and there can be more grids than that, so the primary goes every time
+ * and the others take turns: [process.next] is where in the registry the
+ * next batch starts, a hint only - it is fine for the registry to have
+ * changed in between. [waiting] is set if some grid didn't fit, the events
+ * for it are only processed once its turn comes.
+ */
+static struct tui_context** process_contexts(size_t* n, bool* waiting)
+{
+	size_t start = nvim.process.next;
+	size_t pos = start;
+	bool wrapped = false;
+	struct nvim_meta* m;
+
+	nvim.process.set[0] = nvim.tui;
+	*n = 1;
+	*waiting = false;
+
+	for (;;){
+		if (!(m = grids_next(&pos))){
+			if (wrapped || !start)
+				break;
+
+			wrapped = true;
+			pos = 0;
+			continue;
+		}
+
+/* back where this batch started, everything has had its turn */
+		if (wrapped && pos > start)
+			break;
+
+		if (!m->tui || m->tui == nvim.tui)
+			continue;
+
+/* the batch is full, the next one starts with this grid */
+		if (*n == TUI_PROCESS_MAX){
+			*waiting = true;
+			pos--;
+			break;
+		}
+
+		nvim.process.set[(*n)++] = m->tui;
+	}
+
+	nvim.process.next = pos;
+	return nvim.process.set;
+}
+
+/*
+ * Pastes from the tui arrive as fragments of whatever size the display
+ * server used. They are collected per grid and sent as nvim_paste phases of
+ * up to PASTE_CHUNK bytes, cut after a line break where there is one and
+ * never inside a utf8 sequence. At most PASTE_INFLIGHT phases wait for a
+ * response, the responses pace the rest. nvim_paste has no notion of where
+ * a paste comes from, so only the first paste in the list is sent - one
+ * from another grid waits until the one before it has ended.
+ *
+ * Fragments are delivered as fast as the tui context is processed, and that
+ * context also has the keyboard, so it is never held back. Once PASTE_BUFFER
+ * bytes are waiting in memory the rest goes to an unlinked temporary file
+ * (paste_spill) and is read back one phase at a time. If that can't be
+ * written either the rest of the paste is dropped and nvim shows an error.
+ */
+#define PASTE_CHUNK (64 * 1024)
+#define PASTE_INFLIGHT 4
+#define PASTE_BUFFER (4 * 1024 * 1024)
+
+struct paste {
+/* set by the response callback, nvim.pastes.lock - once nvim has refused a
+ * phase nothing more of the paste is sent */
+	size_t inflight;
+	bool cancelled;
+
+	int grid_id;
+
+/* the last fragment has arrived */
+	bool ended;
+
+/* the final phase (3, or -1 if it was the only one) has been sent */
+	bool finished;
+	size_t phases;
+	uint64_t bytes;
+
+/* [pos] to [used] is what hasn't been sent yet */
+	uint8_t* buf;
+	size_t pos, used, cap;
+
+/* what didn't fit in memory, [spilled] bytes from [spill_pos] on are still
+ * in [spill] - and everything after them goes there as well, to keep the
+ * order. Fragments that couldn't be kept at all are [refused] */
+	int spill;
+	uint64_t spill_pos, spilled;
+	bool refused;
+
+	struct paste* next;
+};
+
+static void paste_done(void* tag,
+	const msgpack_object* error, const msgpack_object* result)
+{
+	struct paste* job = tag;
+
+	pthread_mutex_lock(&nvim.pastes.lock);
+	job->inflight--;
+	if (error || !result ||
+		(result->type == MSGPACK_OBJECT_BOOLEAN && !result->via.boolean))
+		job->cancelled = true;
+	pthread_mutex_unlock(&nvim.pastes.lock);
+
+	if (!nvim.single_thread)
+		wake_render();
+}
+
+/* the paste from [grid_id] that more fragments are expected for, if any */
+static struct paste* paste_receiving(int grid_id)
+{
+	for (struct paste* job = nvim.pastes.list; job; job = job->next){
+		if (job->grid_id == grid_id && !job->ended)
+			return job;
+	}
+
+	return NULL;
+}
+
+/* room for [len] more after [used] */
+static bool paste_reserve(struct paste* job, size_t len)
+{
+	if (job->pos && job->used + len > job->cap){
+		memmove(job->buf, &job->buf[job->pos], job->used - job->pos);
+		job->used -= job->pos;
+		job->pos = 0;
+	}
+
+	if (job->used + len > job->cap){
+		size_t cap = job->cap ? job->cap : PASTE_CHUNK;
+		while (cap < job->used + len)
+			cap *= 2;
+
+		uint8_t* buf = realloc(job->buf, cap);
+		if (!buf)
+			return false;
+
+		job->buf = buf;
+		job->cap = cap;
+	}
+
+	return true;
+}
+
+static bool paste_spill(struct paste* job, const uint8_t* str, size_t len)
+{
+	if (-1 == job->spill){
+		const char* dir = getenv("TMPDIR");
+		char path[PATH_MAX];
+		snprintf(path, sizeof(path),
+			"%s/nvim-arcan-paste-XXXXXX", dir && *dir ? dir : "/tmp");
+
+		job->spill = mkostemp(path, O_CLOEXEC);
+		if (-1 == job->spill){
+			trace("paste: couldn't create %s: %d", path, errno);
+			return false;
+		}
+		unlink(path);
+	}
+
+	while (len){
+		ssize_t nw = pwrite(job->spill, str, len, job->spill_pos + job->spilled);
+		if (-1 == nw && errno == EINTR)
+			continue;
+
+		if (nw <= 0){
+			trace("paste: spill write error: %d", errno);
+			return false;
+		}
+
+		str += nw;
+		len -= nw;
+		job->spilled += nw;
+		job->bytes += nw;
+	}
+
+	return true;
+}
+
+static bool paste_append(struct paste* job, const uint8_t* str, size_t len)
+{
+	if (job->spilled || nvim.pastes.buffered + len > PASTE_BUFFER)
+		return paste_spill(job, str, len);
+
+	if (!paste_reserve(job, len))
+		return false;
+
+	memcpy(&job->buf[job->used], str, len);
+	job->used += len;
+	job->bytes += len;
+	nvim.pastes.buffered += len;
+	return true;
+}
+
+/* the rest of the paste is dropped, what has been kept still goes out */
+static void paste_refuse(struct paste* job)
+{
+	job->refused = true;
+	job->spilled = 0;
+
+	const char cmd[] = "nvim_err_writeln";
+	const char msg[] = "nvim-arcan: paste too large to buffer, the rest was dropped";
+	nvim_request_str(cmd, sizeof(cmd) - 1);
+	msgpack_pack_array(nvim.out, 1);
+	msgpack_pack_str(nvim.out, sizeof(msg) - 1);
+	msgpack_pack_str_body(nvim.out, msg, sizeof(msg) - 1);
+}
+
+/* read back what has been spilled until there is a full phase in memory */
+static void paste_refill(struct paste* job)
+{
+	while (job->spilled && job->used - job->pos < PASTE_CHUNK){
+		size_t len = job->spilled < PASTE_CHUNK ? job->spilled : PASTE_CHUNK;
+		if (!paste_reserve(job, len)){
+			paste_refuse(job);
+			return;
+		}
+
+		ssize_t nr = pread(job->spill, &job->buf[job->used], len, job->spill_pos);
+		if (-1 == nr && errno == EINTR)
+			continue;
+
+		if (nr <= 0){
+			trace("paste: spill read error: %d", errno);
+			paste_refuse(job);
+			return;
+		}
+
+		job->used += nr;
+		job->spill_pos += nr;
+		job->spilled -= nr;
+		nvim.pastes.buffered += nr;
+	}
+
+/* all of it is back, start over rather than letting the file grow */
+	if (-1 != job->spill && !job->spilled && job->spill_pos){
+		ftruncate(job->spill, 0);
+		job->spill_pos = 0;
+	}
+}
+
+/* how much goes in the next phase: up to PASTE_CHUNK, after the last line
+ * break in that if there is one, otherwise not inside a utf8 sequence or
+ * between \r and \n */
+static size_t paste_cut(const struct paste* job)
+{
+	const uint8_t* data = &job->buf[job->pos];
+	size_t avail = job->used - job->pos;
+
+	if (job->ended && !job->spilled && avail <= PASTE_CHUNK)
+		return avail;
+
+	size_t n = avail < PASTE_CHUNK ? avail : PASTE_CHUNK;
+	for (size_t i = n; i > 0; i--){
+		if (data[i - 1] == '\n')
+			return i;
+	}
+
+	size_t cut = n;
+	while (cut > 0 && cut < avail && (data[cut] & 0xc0) == 0x80)
+		cut--;
+
+	if (cut > 0 && data[cut - 1] == '\r')
+		cut--;
+
+	return cut ? cut : n;
+}
+
+static void paste_send(struct paste* job, size_t len, int phase)
+{
+	const char cmd[] = "nvim_paste";
+
+	pthread_mutex_lock(&nvim.pastes.lock);
+	job->inflight++;
+	pthread_mutex_unlock(&nvim.pastes.lock);
+
+	rpc_request(cmd, sizeof(cmd) - 1, paste_done, job);
+	msgpack_pack_array(nvim.out, 3);
+	msgpack_pack_str(nvim.out, len);
+	msgpack_pack_str_body(nvim.out, &job->buf[job->pos], len);
+/* should possibly expose as a label to get controls for CR/LF, CRLF, LF */
+	msgpack_pack_true(nvim.out);
+	msgpack_pack_int(nvim.out, phase);
+
+	job->pos += len;
+	job->phases++;
+	nvim.pastes.buffered -= len;
+}
+
+static void paste_free(struct paste* job)
+{
+	trace("paste: %"PRIu64" bytes in %zu phases%s%s", job->bytes,
+		job->phases, job->cancelled ? ", cancelled" : "",
+		job->refused ? ", truncated" : "");
+
+	nvim.pastes.buffered -= job->used - job->pos;
+	if (-1 != job->spill)
+		close(job->spill);
+	free(job->buf);
+	free(job);
+}
+
+/*
+ * main loop, send what the first paste has buffered as long as there is
+ * room in flight and move on to the next one once it has been answered
+ */
+static void paste_pump()
+{
+	while (nvim.pastes.list){
+		struct paste* job = nvim.pastes.list;
+
+		pthread_mutex_lock(&nvim.pastes.lock);
+		size_t inflight = job->inflight;
+		bool cancelled = job->cancelled;
+		pthread_mutex_unlock(&nvim.pastes.lock);
+
+		if (cancelled){
+			nvim.pastes.buffered -= job->used - job->pos;
+			job->pos = job->used = 0;
+			job->spilled = 0;
+		}
+
+/* -1 : single, 1 : first in multipart, 2 : part in multipart, 3 : end */
+		while (!cancelled && !job->finished && inflight < PASTE_INFLIGHT){
+			paste_refill(job);
+			size_t avail = job->used - job->pos;
+			if (!job->ended && avail < PASTE_CHUNK)
+				break;
+
+/* nothing at all, not worth a request */
+			if (!avail && !job->phases){
+				job->finished = true;
+				break;
+			}
+
+			size_t len = paste_cut(job);
+			bool last = job->ended && !job->spilled && len == avail;
+			paste_send(job, len, job->phases ? (last ? 3 : 2) : (last ? -1 : 1));
+			job->finished = last;
+			inflight++;
+		}
+
+		if (!job->ended || inflight || !(job->finished || cancelled))
+			return;
+
+		nvim.pastes.list = job->next;
+		paste_free(job);
+	}
+}
+
+static void paste_cancel()
+{
+	while (nvim.pastes.list){
+		struct paste* job = nvim.pastes.list;
+		nvim.pastes.list = job->next;
+		paste_free(job);
+	}
+}
+
+static void on_mouse_button(struct tui_context* c,
+	int last_x, int last_y, int button, bool active, int modifiers, void* t)
+{
+	trace("mouse_btn(%d:%d, mods:%d, index: %d)", last_x, last_y, modifiers, button);
+	struct nvim_meta* m = t;
+
+/* don't consider release for wheel action */
+	if (!active && button >= TUIBTN_WHEEL_UP)
+		return;
+
+	const char* action, (* btn);
+
+	/* 1: {button} */
+	bool wheel = false;
+	switch(button){
+	case TUIBTN_LEFT:
+		btn = "left";
+	break;
+	case TUIBTN_RIGHT:
+		btn = "right";
+	break;
+	case TUIBTN_MIDDLE:
+		btn = "middle";
+	break;
+	case TUIBTN_WHEEL_UP:
+	case TUIBTN_WHEEL_DOWN:
+	default:
+		wheel = true;
+		btn = "wheel";
+	break;
+	}
+
+/* 2: {action} */
+	if (wheel){
+		if (button == TUIBTN_WHEEL_UP){
+			action = "up";
+		}
+		else {
+			action = "down";
+		}
+	}
+	else if (active){
+		action = "press";
+		m->button_mask |= 1 << TUIBTN_LEFT;
+	}
+	else {
+		m->button_mask &= ~(1 << TUIBTN_LEFT);
+		action = "release";
+	}
+
+/* modifier to button follows same rule as for normal input,
+ * i.e. C-A (though not as <Ca> */
+
+	if (wheel){
+		queue_mouse(m, MOUSE_WHEEL, btn, action, last_y, last_x);
+		return;
+	}
+
+	flush_mice();
+	build_mouse_packet(btn, action, "", m->grid_id, last_y, last_x);
+}
+
+static void on_mouse(struct tui_context* c,
+	bool relative, int x, int y, int modifiers, void* t)
+{
+	struct nvim_meta* m = t;
+	if (!m->button_mask || relative)
+		return;
+
+	const char* btn = "left";
+	if (TUIBTN_LEFT & m->button_mask)
+		btn = "left";
+	else if (TUIBTN_RIGHT & m->button_mask)
+		btn = "right";
+	else if (TUIBTN_MIDDLE & m->button_mask)
+		btn = "middle";
+	else
+		return;
+
+	queue_mouse(m, MOUSE_DRAG, btn, "drag", y, x);
+}
+
+static void queue_key(const char* str, size_t len)
+{
+	if (len > sizeof(nvim.keys.buf))
+		return;
+
+/* pending mouse input has to go before the key to keep the order */
+	flush_mice();
+
+	if (nvim.keys.ofs + len > sizeof(nvim.keys.buf))
+		flush_keys();
+
+	memcpy(&nvim.keys.buf[nvim.keys.ofs], str, len);
+	nvim.keys.ofs += len;
+	nvim.keys.count++;
+
+/* only the first key since the last flush, the rest are in its shadow */
+	uint64_t none = 0;
+	atomic_compare_exchange_strong(&nvim.latency.key_start, &none, now_ns());
+}
+
+static void on_key(struct tui_context* c, uint32_t ksym,
+	uint8_t scancode, uint16_t mods, uint16_t subid, void* t)
+{
+	trace_ev(TRACE_KEY, 0, 0, ksym, mods);
+
+	char str[32];
+	size_t ofs = 0;
+
+	str[ofs++] = '<';
 
 	if (mods & (TUIM_LCTRL | TUIM_RCTRL)){
 		str[ofs++] = 'C';
@@ -530,32 +2482,17 @@ static void on_key(struct tui_context* c, uint32_t ksym,
 	}
 
 	str[ofs++] = '>';
-	const char cmd[] = "nvim_input";
-	nvim_request_str(cmd, sizeof(cmd) - 1);
-	msgpack_pack_array(nvim.out, 1);
-	msgpack_pack_str(nvim.out, ofs);
-	msgpack_pack_str_body(nvim.out, str, ofs);
-	str[ofs++] = 0;
+	queue_key(str, ofs);
 }
 
 static bool on_u8(struct tui_context* c, const char* u8, size_t len, void* t)
 {
-	uint8_t buf[5] = {0};
-	memcpy(buf, u8, len >= 5 ? 4 : len);
-	trace("on_u8(%zu:%s)", len, buf);
-
-	const char cmd[] = "nvim_input";
-	nvim_request_str(cmd, sizeof(cmd) - 1);
-	msgpack_pack_array(nvim.out, 1);
+	trace_ev(TRACE_KEY, 0, len, 0, 0);
 
-	if (*u8 == '<'){
-		msgpack_pack_str(nvim.out, 4);
-		msgpack_pack_str_body(nvim.out, "<LT>", 4);
-	}
-	else {
-		msgpack_pack_str(nvim.out, len);
-		msgpack_pack_str_body(nvim.out, u8, len);
-	}
+	if (*u8 == '<')
+		queue_key("<LT>", 4);
+	else
+		queue_key(u8, len);
 
 	return true;
 }
@@ -573,11 +2510,12 @@ static void on_state(struct tui_context* c, bool input, int fd, void* t)
 static void on_bchunk(struct tui_context* c,
 	bool input, uint64_t size, int fd, const char* type, void* t)
 {
-	if (!input){
-		request_buffer_contents(fd);
-	}
+	flush_input();
+
+	if (!input)
+		export_start(fd);
 	else
-		close(fd);
+		import_start(fd, size);
 
 	trace("on_bchunk(%"PRIu64", in:%d)", size, (int)input);
 }
@@ -603,60 +2541,51 @@ static void on_tick(struct tui_context* c, void* t)
 static void on_utf8_paste(struct tui_context* c,
 	const uint8_t* str, size_t len, bool cont, void* t)
 {
-	trace("utf8-paste(%s):%d", str, (int) cont);
-	/* nvim_paste(data, cont ? phase == -1 single, 1: first, 2: cont, 3: end */
-	const char cmd[] = "nvim_paste";
+	trace("utf8-paste(%zu):%d", len, (int) cont);
 	struct nvim_meta* nvim_grid = t;
 
-/*
- * -1 : single
- *  1 : first in multipart
- *  2 : part in multipart
- *  3 : end of multipart
- */
-	int mode = -1;
-
-	if (-1 == nvim.paste_lock){
-		if (cont){
-			mode = 1;
-			nvim.paste_lock = nvim_grid->grid_id;
+/* keys typed before the paste go first */
+	flush_input();
+
+/* a fragment of a multipart paste in progress, otherwise a new paste - which
+ * waits for any other grid's paste to end (see paste_pump) */
+	struct paste* job = paste_receiving(nvim_grid->grid_id);
+	if (!job){
+		job = malloc(sizeof(struct paste));
+		if (!job){
+			trace("paste: out of memory, dropped");
+			return;
 		}
-	}
 
-/* ignore the paste, already busy here - if it becomes a problem, possibly
- * dup and queue - the thing is that paste does not carry a grid id so screwed
- * anyhow without modifying nvim */
-	else if (nvim.paste_lock != nvim_grid->grid_id){
-		return;
-	}
-	else {
-		if (cont){
-			mode = 2;
-		}
-		else {
-			mode = 3;
-			nvim.paste_lock = -1;
-		}
+		*job = (struct paste){.grid_id = nvim_grid->grid_id, .spill = -1};
+		struct paste** tail = &nvim.pastes.list;
+		while (*tail)
+			tail = &(*tail)->next;
+		*tail = job;
 	}
 
-	nvim_request_str(cmd, sizeof(cmd) - 1);
+	pthread_mutex_lock(&nvim.pastes.lock);
+	bool cancelled = job->cancelled;
+	pthread_mutex_unlock(&nvim.pastes.lock);
 
-	msgpack_pack_array(nvim.out, 3);
-	msgpack_pack_str(nvim.out, len);
-	msgpack_pack_str_body(nvim.out, str, len);
-/* should possibly expose as a label to get controls for CR/LF, CRLF, LF */
-	msgpack_pack_int(nvim.out, true);
-	msgpack_pack_int(nvim.out, mode);
+	if (!cancelled && !job->refused && !paste_append(job, str, len)){
+		trace("paste: %zu bytes dropped", len);
+		paste_refuse(job);
+	}
+
+	if (!cont)
+		job->ended = true;
 }
 
 static void on_resize(struct tui_context* c,
 	size_t neww, size_t newh, size_t col, size_t row, void* t)
 {
-	trace("resize(%zu(%zu),%zu(%zu))", neww, col, newh, row);
 	struct nvim_meta* m = t;
+	trace_ev(TRACE_RESIZE, m->grid_id, 0, col, row);
 	if (!nvim.out)
 		return;
 
+	flush_input();
 	const char cmd[] = "nvim_ui_try_resize_grid";
 	nvim_request_str(cmd, sizeof(cmd) - 1);
 	msgpack_pack_array(nvim.out, 3);
@@ -672,98 +2601,183 @@ struct nvim_cmd {
 
 /* this comes from the notifications, so it expects it to be of
  * [cmd, [grid, ...]] */
-static struct tui_context* nvim_grid_to_tui(const msgpack_object_array* arg)
+static bool nvim_grid_arg(const msgpack_object_array* arg, uint32_t* grid)
 {
 	if (arg->size < 2 ||
 		arg->ptr[1].type != MSGPACK_OBJECT_ARRAY ||
 		arg->ptr[1].via.array.size < 1 ||
 		arg->ptr[1].via.array.ptr[0].type != MSGPACK_OBJECT_POSITIVE_INTEGER)
-		return NULL;
-
-/* find matching and if not, grab first free and set the grid-id, request
- * a new tui window for it - since this is asynch and we need a context
- * directly to make things easier
- *
- * The solution to that is to extend tui with the option of making a
- * 'connectionless- tui' window that behaves like a normal one, but won't
- * refresh / transfer / do anything. Then when we get a subwindow event, we can
- * quickly transfer this with a 'window_bind' call.
- */
-	if (nvim.multigrid){
-/*		uint64_t grid_id = arg->ptr[1].via.array.ptr[0].via.u64; */
-		for (size_t i = 0; i < nvim.n_grids; i++){
-		}
-	}
+		return false;
 
-/* incomplete, need to map grid to active context */
-	return nvim.grids[0];
+	*grid = arg->ptr[1].via.array.ptr[0].via.u64;
+	return true;
 }
 
 static bool draw_resize(const msgpack_object_array* arg)
 {
 /* arcan_tui_wndhint */
+	for (size_t i = 1; i < arg->size; i++){
+		if (arg->ptr[i].type != MSGPACK_OBJECT_ARRAY)
+			return false;
+
+/* grid, width, height */
+		const msgpack_object_array* rargs = &arg->ptr[i].via.array;
+		if (rargs->size != 3 ||
+			rargs->ptr[0].type != MSGPACK_OBJECT_POSITIVE_INTEGER ||
+			rargs->ptr[1].type != MSGPACK_OBJECT_POSITIVE_INTEGER ||
+			rargs->ptr[2].type != MSGPACK_OBJECT_POSITIVE_INTEGER)
+			return false;
+
+		push_op((struct draw_op){
+			.kind = OP_RESIZE,
+			.grid = rargs->ptr[0].via.u64,
+			.resize = {
+				.cols = rargs->ptr[1].via.u64,
+				.rows = rargs->ptr[2].via.u64
+			}
+		});
+	}
+
+	return true;
+}
+
+/* decode the first codepoint in a grid_line cell, the empty string is used
+ * for the right half of double-width characters and maps to 0 */
+static uint32_t cell_codepoint(const msgpack_object_str* str)
+{
+	const uint8_t* p = (const uint8_t*) str->ptr;
+	if (!str->size)
+		return 0;
+
+	size_t len = 1;
+	uint32_t cp = p[0];
+
+	if (p[0] >= 0xf0){
+		len = 4;
+		cp = p[0] & 0x07;
+	}
+	else if (p[0] >= 0xe0){
+		len = 3;
+		cp = p[0] & 0x0f;
+	}
+	else if (p[0] >= 0xc0){
+		len = 2;
+		cp = p[0] & 0x1f;
+	}
+	else if (p[0] >= 0x80)
+		return 0xfffd;
+
+	if (len > str->size)
+		return 0xfffd;
+
+	for (size_t i = 1; i < len; i++)
+		cp = (cp << 6) | (p[i] & 0x3f);
+
+	return cp;
+}
+
+static void highlight_resolve(size_t id)
+{
+	struct hl_state* state = &highlights.state[id];
+	struct tui_screen_attr* attr = &highlights.attr[id];
+
+	if (!state->defined){
+		*attr = nvim.defattr;
+		return;
+	}
+
+	*attr = state->attr;
+	if (!state->got_fg)
+		memcpy(attr->fc, nvim.defattr.fc, 3);
+	if (!state->got_bg)
+		memcpy(attr->bc, nvim.defattr.bc, 3);
+}
+
+/* make sure [id] can be used as an index into the highlight table */
+static bool highlight_reserve(uint64_t id)
+{
+	if (id < highlights.count)
+		return true;
+
+/* ids are allocated sequentially by nvim, anything this large is garbage */
+	if (id > 0xffffff)
+		return false;
+
+	size_t count = highlights.count ? highlights.count : 256;
+	while (count <= id)
+		count *= 2;
+
+	struct hl_state* state =
+		realloc(highlights.state, sizeof(struct hl_state) * count);
+	if (!state)
+		return false;
+	highlights.state = state;
+
+	struct tui_screen_attr* attr =
+		realloc(highlights.attr, sizeof(struct tui_screen_attr) * count);
+	if (!attr)
+		return false;
+	highlights.attr = attr;
+
+	for (size_t i = highlights.count; i < count; i++){
+		highlights.state[i] = (struct hl_state){0};
+		highlights.attr[i] = nvim.defattr;
+	}
+
+	highlights.count = count;
+	metric_set(&nvim.stats.hl_slots, count);
 	return true;
 }
 
-static bool draw_line(int gid,
+static bool draw_line(uint32_t grid,
 	unsigned row, unsigned offset, const msgpack_object_array* line)
 {
-	struct tui_context* grid = nvim.grids[0];
-	struct tui_cbcfg cbcfg;
-	arcan_tui_update_handlers(grid, NULL, &cbcfg, sizeof(cbcfg));
-	struct nvim_meta* grid_meta = cbcfg.tag;
-	arcan_tui_move_to(grid, offset, row);
+	push_op((struct draw_op){
+		.kind = OP_LINE,
+		.grid = grid,
+		.pos = {.row = row, .col = offset}
+	});
 
 /* format depends on individual line size:
  * 1 item  : [ch]
  * 2 items : [ch, hlid]
  * 3 items : [ch, hlid, repeat]
  *
- * if hlid is not set, grab the last defined one - global */
-	struct tui_screen_attr defattr = arcan_tui_defattr(grid, NULL);
-	struct tui_screen_attr cattr = defattr;
-	struct hl_state* hl = NULL;
-
+ * if hlid is not set, grab the last defined one - this is resolved by the
+ * render thread as it owns the highlight table */
 	for (size_t i = 0; i < line->size; i++){
 		if (line->ptr[i].type != MSGPACK_OBJECT_ARRAY)
 			return false;
 		const msgpack_object_array* cell = &line->ptr[i].via.array;
 
-		if (cell->ptr[0].type != MSGPACK_OBJECT_STR)
+		if (!cell->size || cell->ptr[0].type != MSGPACK_OBJECT_STR)
 			return false;
 
+		uint64_t id = CELL_HL_KEEP;
 		if (cell->size > 1){
-			struct hl_state* new;
-			HASH_FIND_INT(highlights, &cell->ptr[1].via.u64, new);
-			if (new)
-				hl = new;
-		}
-
-		if (hl){
-			cattr = hl->attr;
-			if (!hl->got_fg)
-				memcpy(cattr.fc, defattr.fc, 3);
-			if (!hl->got_bg)
-				memcpy(cattr.bc, defattr.bc, 3);
-		}
-		else {
-			trace("missing highlight attribute");
+			if (cell->ptr[1].type != MSGPACK_OBJECT_POSITIVE_INTEGER)
+				return false;
+			id = cell->ptr[1].via.u64;
 		}
 
-		size_t count = 1;
+		uint64_t count = 1;
 		if (cell->size == 3)
 			count = cell->ptr[2].via.u64;
-
-		for (size_t i = 0; i < count; i++)
-			arcan_tui_writeu8(grid,
-				(uint8_t*) cell->ptr[0].via.str.ptr,
-				cell->ptr[0].via.str.size, &cattr
-			);
+		if (count > UINT32_MAX)
+			count = UINT32_MAX;
+
+		push_op((struct draw_op){
+			.kind = OP_CELL,
+			.grid = grid,
+			.cell = {
+				.ch = cell_codepoint(&cell->ptr[0].via.str),
+				.count = count,
+				.hl = id
+			}
+		});
+		metric_add(&nvim.stats.cells_received, count);
 	}
 
-/* restore known cursor position, not doing this caused the
- * cursor to sometimes look like it was stuck at end of line */
-	arcan_tui_move_to(grid, grid_meta->cx, grid_meta->cy);
 	return true;
 }
 
@@ -797,6 +2811,10 @@ static bool draw_lines(const msgpack_object_array* arg)
 
 		uint64_t col = l->ptr[2].via.u64;
 
+		if (l->ptr[3].type != MSGPACK_OBJECT_ARRAY)
+			return false;
+
+		trace_ev(TRACE_GRID_LINE, grid, l->ptr[3].via.array.size, row, col);
 		if (!draw_line(grid, row, col, &l->ptr[3].via.array))
 			return false;
 /* rest is array of characters */
@@ -807,39 +2825,36 @@ static bool draw_lines(const msgpack_object_array* arg)
 
 static bool grid_clear(const msgpack_object_array* arg)
 {
-	struct tui_context* tui = nvim_grid_to_tui(arg);
-	if (!tui)
+	uint32_t grid;
+	if (!nvim_grid_arg(arg, &grid))
 		return false;
 
-	arcan_tui_erase_screen(tui, false);
+	push_op((struct draw_op){.kind = OP_CLEAR, .grid = grid});
 	return true;
 }
 
 static bool draw_destroy(const msgpack_object_array* arg)
 {
-	return true;
-}
-
-static void copy_row(
-	struct tui_context* T, size_t l, size_t r, size_t src, size_t dst)
-{
-	arcan_tui_move_to(T, l, dst);
-	for (size_t col = l; col < r; col++){
-		struct tui_cell cell = arcan_tui_getxy(T, col, src, true);
-/* this might be a bug with tui, investigate - sometimes cells with
- * zero content won't get cleared / updated, this might be tied to some
- * terminal emulator visual leftovers we have had in the past */
-		if (!cell.ch)
-			cell.ch = ' ';
+	for (size_t i = 1; i < arg->size; i++){
+		if (arg->ptr[i].type != MSGPACK_OBJECT_ARRAY ||
+			arg->ptr[i].via.array.size != 1 ||
+			arg->ptr[i].via.array.ptr[0].type != MSGPACK_OBJECT_POSITIVE_INTEGER)
+			return false;
 
-		arcan_tui_write(T, cell.ch, &cell.attr);
+		push_op((struct draw_op){
+			.kind = OP_DESTROY,
+			.grid = arg->ptr[i].via.array.ptr[0].via.u64
+		});
 	}
+
+	return true;
 }
 
 static bool grid_scroll(const msgpack_object_array* arg)
 {
-	struct tui_context* grid = nvim_grid_to_tui(arg);
-	if (arg->size != 2 || arg->ptr[1].via.array.size != 7)
+	uint32_t grid;
+	if (!nvim_grid_arg(arg, &grid) ||
+		arg->size != 2 || arg->ptr[1].via.array.size != 7)
 		return false;
 
 /* id, top, bottom, left, right, rows, cols */
@@ -876,27 +2891,21 @@ static bool grid_scroll(const msgpack_object_array* arg)
 		trace("non-zero cols");
 	}
 
-/* scroll down */
-	if (rows > 0){
-		for (int64_t crow = t; crow + rows < b; crow++){
-			copy_row(grid, l, r, crow + rows, crow);
-		}
-	}
-	else{
-		for (int64_t crow = b - 1; crow + rows >= t; --crow){
-			copy_row(grid, l, r, crow + rows, crow);
+	push_op((struct draw_op){
+		.kind = OP_SCROLL,
+		.grid = grid,
+		.scroll = {
+			.top = t, .bottom = b, .left = l, .right = r, .rows = rows
 		}
-	}
-
+	});
 	return true;
 }
 
 static bool grid_goto(const msgpack_object_array* arg)
 {
-	struct tui_context* grid = nvim_grid_to_tui(arg);
-	struct tui_cbcfg cbcfg;
-	arcan_tui_update_handlers(grid, NULL, &cbcfg, sizeof(cbcfg));
-	struct nvim_meta* grid_meta = cbcfg.tag;
+	uint32_t grid;
+	if (!nvim_grid_arg(arg, &grid))
+		return false;
 
 /* can now assume [cmd, [gid, ...] structure */
 
@@ -912,39 +2921,46 @@ static bool grid_goto(const msgpack_object_array* arg)
 		return false;
 	uint64_t col = gargs->ptr[2].via.u64;
 
-	grid_meta->cx = col;
-	grid_meta->cy = row;
-	arcan_tui_move_to(grid, col, row);
+	push_op((struct draw_op){
+		.kind = OP_CURSOR,
+		.grid = grid,
+		.pos = {.row = row, .col = col}
+	});
 	return true;
 }
 
 static bool highlight_attribute(const msgpack_object_array* arg)
 {
 	for (size_t i = 1; i < arg->size; i++){
-		struct hl_state* state;
+		if (arg->ptr[i].type != MSGPACK_OBJECT_ARRAY ||
+			arg->ptr[i].via.array.size < 1 ||
+			arg->ptr[i].via.array.ptr[0].type != MSGPACK_OBJECT_POSITIVE_INTEGER)
+			return false;
+
 		const msgpack_object_array* ci = &arg->ptr[i].via.array;
-		uint64_t attrid = ci->ptr[0].via.u64;
 
-/* fetch or add, set default */
-		HASH_FIND_INT(highlights, &attrid, state);
-		if (!state){
-			state = malloc(sizeof(struct hl_state));
-			state->id = attrid;
-			HASH_ADD_INT(highlights, id, state);
+/* ids are allocated sequentially by nvim, anything this large is garbage */
+		if (ci->ptr[0].via.u64 > 0xffffff){
+			trace("hl_attr_define: bad id %"PRIu64, ci->ptr[0].via.u64);
+			return false;
 		}
-		state->attr = arcan_tui_defattr(nvim.grids[0], NULL);
-		state->got_fg = false;
-		state->got_bg = false;
+
+		struct draw_op op = {
+			.kind = OP_HL_DEFINE,
+			.hl.id = ci->ptr[0].via.u64
+		};
 
 /* should be size [4],
  * id (u64), rgb (use this), cterm (ignore this), info (use this) */
 		if (ci->size != 4){
-			trace("hl_attr_define expected [id, rgb, term, info], got: %zu", ci->size);
+			trace("hl_attr_define expected [id, rgb, term, info], got: %"PRIu32, ci->size);
+			push_op(op);
 			continue;
 		}
 
 		if (ci->ptr[1].type != MSGPACK_OBJECT_MAP){
 			trace("hl_attr_define [rgb] not a map");
+			push_op(op);
 			continue;
 		}
 
@@ -956,29 +2972,27 @@ static bool highlight_attribute(const msgpack_object_array* arg)
 				continue;
 
 			if (nvim_str_match(&cm->ptr[j].key.via.str, "foreground")){
-				uint64_t val = cm->ptr[j].val.via.u64;
-				update_cval(val, state->attr.fc);
-				state->got_fg = true;
+				op.hl.fg = cm->ptr[j].val.via.u64;
+				op.hl.got_fg = true;
 			}
 			else if (nvim_str_match(&cm->ptr[j].key.via.str, "background")){
-				uint64_t val = cm->ptr[j].val.via.u64;
-				update_cval(val, state->attr.bc);
-				state->got_bg = true;
+				op.hl.bg = cm->ptr[j].val.via.u64;
+				op.hl.got_bg = true;
 			}
 			else if (nvim_str_match(&cm->ptr[j].key.via.str, "reverse")){
-				state->attr.aflags |= TUI_ATTR_INVERSE;
+				op.hl.aflags |= TUI_ATTR_INVERSE;
 			}
 			else if (nvim_str_match(&cm->ptr[j].key.via.str, "bold")){
-				state->attr.aflags |= TUI_ATTR_BOLD;
+				op.hl.aflags |= TUI_ATTR_BOLD;
 			}
 			else if (nvim_str_match(&cm->ptr[j].key.via.str, "underline")){
-				state->attr.aflags |= TUI_ATTR_UNDERLINE;
+				op.hl.aflags |= TUI_ATTR_UNDERLINE;
 			}
 			else if (nvim_str_match(&cm->ptr[j].key.via.str, "italic")){
-				state->attr.aflags |= TUI_ATTR_ITALIC;
+				op.hl.aflags |= TUI_ATTR_ITALIC;
 			}
 			else if (nvim_str_match(&cm->ptr[j].key.via.str, "strikethrough")){
-				state->attr.aflags |= TUI_ATTR_STRIKETHROUGH;
+				op.hl.aflags |= TUI_ATTR_STRIKETHROUGH;
 			}
 /* Special: can't be done atm, lacks a way to express it in TUI */
 /* Undercurl: missing attribute in TUI, possible but we are out of bits */
@@ -986,51 +3000,27 @@ static bool highlight_attribute(const msgpack_object_array* arg)
 			else {
 			}
 		}
+
+		push_op(op);
 	}
 
 	return true;
 }
 
-static bool highlight_defcol(const msgpack_object_array* arg)
-{
-/*default colors: rgb_fg, rgb_bg, rgb_sp, cterm_fg, cterm_bg */
-	if (arg->ptr[1].type != MSGPACK_OBJECT_ARRAY)
-		return false;
-
-	uint64_t fgc = arg->ptr[1].via.array.ptr[0].via.u64;
-	uint64_t bgc = arg->ptr[1].via.array.ptr[1].via.u64;
-	struct hl_state* state;
-	uint64_t id = 0;
-
-	HASH_FIND_INT(highlights, &id, state);
-	if (!state){
-		state = malloc(sizeof(struct hl_state));
-		state->attr = arcan_tui_defattr(nvim.grids[0], NULL);
-		state->id = 0;
-		HASH_ADD_INT(highlights, id, state);
-	}
-
-	struct tui_screen_attr attr = {
-	};
-	update_cval(fgc, attr.fc);
-	update_cval(bgc, attr.bc);
-	update_cval(fgc, state->attr.fc);
-	update_cval(bgc, state->attr.bc);
-
-	for (size_t i = 0; i < COUNT_OF(nvim.grids); i++){
-		if (!nvim.grids[i])
-			continue;
-
-		arcan_tui_set_color(nvim.grids[i], TUI_COL_PRIMARY, attr.fc);
-		arcan_tui_set_bgcolor(nvim.grids[i], TUI_COL_PRIMARY, attr.bc);
-
-		arcan_tui_set_color(nvim.grids[i], TUI_COL_TEXT, attr.fc);
-		arcan_tui_set_bgcolor(nvim.grids[i], TUI_COL_TEXT, attr.bc);
+static bool highlight_defcol(const msgpack_object_array* arg)
+{
+/*default colors: rgb_fg, rgb_bg, rgb_sp, cterm_fg, cterm_bg */
+	if (arg->ptr[1].type != MSGPACK_OBJECT_ARRAY ||
+		arg->ptr[1].via.array.size < 2)
+		return false;
 
-		arcan_tui_set_bgcolor(nvim.grids[i], TUI_COL_BG, attr.bc);
-		arcan_tui_set_color(nvim.grids[i], TUI_COL_BG, attr.bc);
-		arcan_tui_defattr(nvim.grids[i], &attr);
-	}
+	push_op((struct draw_op){
+		.kind = OP_DEFAULT_COLORS,
+		.colors = {
+			.fg = arg->ptr[1].via.array.ptr[0].via.u64,
+			.bg = arg->ptr[1].via.array.ptr[1].via.u64
+		}
+	});
 
 	return true;
 }
@@ -1055,55 +3045,71 @@ static bool set_title(const msgpack_object_array* arg)
 		return false;
 
 	msgpack_object_str str = gargs[0].ptr[0].via.str;
-	if (str.size == 0){
-		arcan_tui_ident(nvim.grids[0], "");
-	}
-	else {
-		char* buf = malloc(str.size + 1);
-		if (!buf)
-			return true;
-		memcpy(buf, str.ptr, str.size);
-		buf[str.size] = 0;
-		arcan_tui_ident(nvim.grids[0], buf);
-		free(buf);
-	}
-
+	char* buf = malloc(str.size + 1);
+	if (!buf)
+		return true;
+	memcpy(buf, str.ptr, str.size);
+	buf[str.size] = 0;
+
+/* applied by the render thread with the next frame */
+	push_op((struct draw_op){.kind = OP_TITLE, .title = buf});
 	return true;
 }
 
-static bool release_locks(const msgpack_object_array* arg)
+static bool flush_grids(const msgpack_object_array* arg)
 {
-/* this is a bit problematic in the sense that we may well get multiple redraw
- * calls on one frame, so the synch() is needed to align against the refresh,
- * but that lowers the responsiveness for resize etc. only real workaround for
- * that is to have an intermediate buffer for the grid - skipping that for the
- * time being */
-	if (!nvim.lock_level)
-		return false;
-
-	pthread_mutex_unlock(&nvim.synch);
-	if (nvim.lock_level == 2){
-		pthread_mutex_unlock(&nvim.hold);
-	}
+	trace_ev(TRACE_FLUSH, 0, 0,
+		nvim.frame_start ? now_ns() - nvim.frame_start : 0, 0);
+
+/* this is the next flush after the key, not necessarily the one with its
+ * effect, but nvim flushes once it has processed pending input */
+	push_op((struct draw_op){
+		.kind = OP_FLUSH,
+		.flush = {
+			.frame_start = nvim.frame_start,
+			.received = now_ns(),
+			.key = atomic_exchange(&nvim.latency.key_start, 0)
+		}
+	});
+	nvim.frame_start = 0;
 
-	nvim.lock_level = 0;
+/* only wake the render thread if it hasn't been already, in single-threaded
+ * mode the main loop drains after processing input */
+	if (!nvim.single_thread && !atomic_exchange(&nvim.frame_pending, true))
+		wake_render();
 
 	return true;
 }
 
+enum redraw_cmd {
+	REDRAW_GRID_RESIZE = 0,
+	REDRAW_GRID_LINE,
+	REDRAW_GRID_DESTROY,
+	REDRAW_GRID_CLEAR,
+	REDRAW_GRID_CURSOR_GOTO,
+	REDRAW_HL_ATTR_DEFINE,
+	REDRAW_DEFAULT_COLORS_SET,
+	REDRAW_GRID_SCROLL,
+	REDRAW_OPTION_SET,
+	REDRAW_SET_ICON,
+	REDRAW_SET_TITLE,
+	REDRAW_FLUSH,
+	REDRAW_UNKNOWN
+};
+
 static const struct nvim_cmd redraw_cmds[] = {
-	{"grid_resize", draw_resize},
-	{"grid_line", draw_lines},
-	{"grid_destroy", draw_destroy},
-	{"grid_clear", grid_clear},
-	{"grid_cursor_goto", grid_goto},
-	{"hl_attr_define", highlight_attribute},
-	{"default_colors_set", highlight_defcol},
-	{"grid_scroll", grid_scroll},
-	{"option_set", option_set},
-	{"set_icon", set_icon},
-	{"set_title", set_title},
-	{"flush", release_locks}
+	[REDRAW_GRID_RESIZE] = {"grid_resize", draw_resize},
+	[REDRAW_GRID_LINE] = {"grid_line", draw_lines},
+	[REDRAW_GRID_DESTROY] = {"grid_destroy", draw_destroy},
+	[REDRAW_GRID_CLEAR] = {"grid_clear", grid_clear},
+	[REDRAW_GRID_CURSOR_GOTO] = {"grid_cursor_goto", grid_goto},
+	[REDRAW_HL_ATTR_DEFINE] = {"hl_attr_define", highlight_attribute},
+	[REDRAW_DEFAULT_COLORS_SET] = {"default_colors_set", highlight_defcol},
+	[REDRAW_GRID_SCROLL] = {"grid_scroll", grid_scroll},
+	[REDRAW_OPTION_SET] = {"option_set", option_set},
+	[REDRAW_SET_ICON] = {"set_icon", set_icon},
+	[REDRAW_SET_TITLE] = {"set_title", set_title},
+	[REDRAW_FLUSH] = {"flush", flush_grids}
 /*
  * set_scroll_region [top, bottom, left, right]
  * hl_group_set
@@ -1117,74 +3123,600 @@ static const struct nvim_cmd redraw_cmds[] = {
  */
 };
 
+/* number of times each command was seen, [REDRAW_UNKNOWN] for the rest */
+static _Atomic uint64_t redraw_hits[REDRAW_UNKNOWN + 1];
+
+struct redraw_cost {
+	uint64_t calls;
+	uint64_t args;
+	uint64_t ns;
+	uint64_t ns_max;
+};
+
+/* where the time for a redraw command goes: decoding it into draw operations
+ * (input thread) and applying those to the shadow grids (render thread) */
+enum redraw_side {
+	REDRAW_DECODE = 0,
+	REDRAW_APPLY,
+	REDRAW_SIDES
+};
+
+/* the redraw command each kind of operation is pushed for */
+static const enum redraw_cmd op_cmds[] = {
+	[OP_RESIZE] = REDRAW_GRID_RESIZE,
+	[OP_CLEAR] = REDRAW_GRID_CLEAR,
+	[OP_DESTROY] = REDRAW_GRID_DESTROY,
+	[OP_LINE] = REDRAW_GRID_LINE,
+	[OP_CELL] = REDRAW_GRID_LINE,
+	[OP_SCROLL] = REDRAW_GRID_SCROLL,
+	[OP_CURSOR] = REDRAW_GRID_CURSOR_GOTO,
+	[OP_HL_DEFINE] = REDRAW_HL_ATTR_DEFINE,
+	[OP_DEFAULT_COLORS] = REDRAW_DEFAULT_COLORS_SET,
+	[OP_TITLE] = REDRAW_SET_TITLE,
+	[OP_FLUSH] = REDRAW_FLUSH
+};
+
+/*
+ * time spent on each redraw command, measured when NVIM_ARCAN_PROFILE=seconds
+ * is set or when tracing. Each side collects the commands since the last
+ * flush in its own [frame], the render side per operation and attributed to
+ * the command it came from. At the flush the frame is written to the trace
+ * as TRACE_REDRAW_COST and folded into [total] under [lock], which is
+ * summarised on stderr every [interval] ns (0: only on exit) and on exit.
+ */
+static struct {
+	bool enabled;
+	bool summary;
+	uint64_t interval;
+	uint64_t last;
+	pthread_mutex_t lock;
+	struct redraw_cost frame[REDRAW_SIDES][REDRAW_UNKNOWN];
+	struct redraw_cost total[REDRAW_SIDES][REDRAW_UNKNOWN];
+} redraw_profile = {
+	.lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+static void redraw_cost_add(struct redraw_cost* c, uint64_t ns, uint64_t args)
+{
+	c->calls++;
+	c->args += args;
+	c->ns += ns;
+	if (ns > c->ns_max)
+		c->ns_max = ns;
+}
+
+static void redraw_cost_fold(struct redraw_cost* into, const struct redraw_cost* c)
+{
+	into->calls += c->calls;
+	into->args += c->args;
+	into->ns += c->ns;
+	if (c->ns_max > into->ns_max)
+		into->ns_max = c->ns_max;
+}
+
+/* most expensive (both sides together) first, so the command to look at is
+ * on top - the render side counts operations rather than calls */
+static void redraw_profile_dump(FILE* out)
+{
+	size_t order[REDRAW_UNKNOWN];
+	uint64_t ns[REDRAW_UNKNOWN];
+	uint64_t sum = 0;
+
+	pthread_mutex_lock(&redraw_profile.lock);
+	const struct redraw_cost* dec = redraw_profile.total[REDRAW_DECODE];
+	const struct redraw_cost* app = redraw_profile.total[REDRAW_APPLY];
+
+	for (size_t i = 0; i < REDRAW_UNKNOWN; i++){
+		ns[i] = dec[i].ns + app[i].ns;
+		size_t j = i;
+		for (; j > 0 && ns[order[j - 1]] < ns[i]; j--)
+			order[j] = order[j - 1];
+		order[j] = i;
+		sum += ns[i];
+	}
+
+	fprintf(out, "redraw profile: %-18s %10s %10s %10s %9s %9s "
+		"%10s %10s %9s %9s %6s\n", "command", "calls", "args", "decode ms",
+		"avg us", "max us", "ops", "apply ms", "avg us", "max us", "share");
+
+	for (size_t i = 0; i < REDRAW_UNKNOWN; i++){
+		const struct redraw_cost* d = &dec[order[i]];
+		const struct redraw_cost* a = &app[order[i]];
+		if (!d->calls && !a->calls)
+			continue;
+
+		fprintf(out, "redraw profile: %-18s %10"PRIu64" %10"PRIu64
+			" %10.3f %9.2f %9.2f %10"PRIu64" %10.3f %9.2f %9.2f %5.1f%%\n",
+			redraw_cmds[order[i]].lbl, d->calls, d->args, (double) d->ns / 1e6,
+			d->calls ? (double) d->ns / d->calls / 1000.0 : 0.0,
+			(double) d->ns_max / 1000.0, a->calls, (double) a->ns / 1e6,
+			a->calls ? (double) a->ns / a->calls / 1000.0 : 0.0,
+			(double) a->ns_max / 1000.0, sum ? 100.0 * ns[order[i]] / sum : 0.0);
+	}
+	pthread_mutex_unlock(&redraw_profile.lock);
+}
+
+/* the frame breakdown of one side goes to the trace and into the total,
+ * then starts over */
+static void redraw_profile_frame(enum redraw_side side)
+{
+	pthread_mutex_lock(&redraw_profile.lock);
+	for (size_t i = 0; i < REDRAW_UNKNOWN; i++){
+		struct redraw_cost* c = &redraw_profile.frame[side][i];
+		if (!c->calls)
+			continue;
+
+		trace_ev(TRACE_REDRAW_COST, 0,
+			c->calls, i, c->ns, c->ns_max, c->args, side);
+		redraw_cost_fold(&redraw_profile.total[side][i], c);
+		*c = (struct redraw_cost){0};
+	}
+	pthread_mutex_unlock(&redraw_profile.lock);
+
+/* the input side keeps the time, so there is one summary per interval */
+	if (!redraw_profile.interval || side != REDRAW_DECODE)
+		return;
+
+	uint64_t now = now_ns();
+	if (now - redraw_profile.last >= redraw_profile.interval){
+		redraw_profile_dump(stderr);
+		redraw_profile.last = now;
+	}
+}
+
+/* [start] is when [side] started on [cmd] with [args] arguments */
+static void redraw_profile_add(enum redraw_side side,
+	enum redraw_cmd cmd, uint64_t start, uint64_t args)
+{
+	redraw_cost_add(&redraw_profile.frame[side][cmd], now_ns() - start, args);
+
+	if (cmd == REDRAW_FLUSH)
+		redraw_profile_frame(side);
+}
+
+/*
+ * map an event name to its entry in redraw_cmds, the length and one byte
+ * that differs between commands of the same length narrows it down to one
+ * candidate which then only needs a single compare. When adding a command,
+ * add it to the case for its length.
+ */
+static enum redraw_cmd redraw_lookup(const msgpack_object_str* str)
+{
+	enum redraw_cmd cmd = REDRAW_UNKNOWN;
+	const char* p = str->ptr;
+
+	switch (str->size){
+	case 5:
+		cmd = REDRAW_FLUSH;
+	break;
+	case 8:
+		cmd = REDRAW_SET_ICON;
+	break;
+	case 9:
+		cmd = p[0] == 'g' ? REDRAW_GRID_LINE : REDRAW_SET_TITLE;
+	break;
+	case 10:
+		cmd = p[0] == 'g' ? REDRAW_GRID_CLEAR : REDRAW_OPTION_SET;
+	break;
+/* grid_resize, grid_scroll */
+	case 11:
+		cmd = p[5] == 'r' ? REDRAW_GRID_RESIZE : REDRAW_GRID_SCROLL;
+	break;
+	case 12:
+		cmd = REDRAW_GRID_DESTROY;
+	break;
+	case 14:
+		cmd = REDRAW_HL_ATTR_DEFINE;
+	break;
+	case 16:
+		cmd = REDRAW_GRID_CURSOR_GOTO;
+	break;
+	case 18:
+		cmd = REDRAW_DEFAULT_COLORS_SET;
+	break;
+	default:
+		return REDRAW_UNKNOWN;
+	}
+
+	if (memcmp(p, redraw_cmds[cmd].lbl, str->size) != 0)
+		return REDRAW_UNKNOWN;
+
+	return cmd;
+}
+
+/* [cmd, args...] */
+static void redraw_event(const msgpack_object_array* iarg)
+{
+	if (!iarg->size || iarg->ptr[0].type != MSGPACK_OBJECT_STR){
+		trace("bad arg");
+		return;
+	}
+
+	const msgpack_object_str* str = &iarg->ptr[0].via.str;
+	enum redraw_cmd cmd = redraw_lookup(str);
+	metric_add(&redraw_hits[cmd], 1);
+	trace_ev(TRACE_REDRAW_EVENT, 0, iarg->size - 1, cmd, 0);
+
+	if (cmd == REDRAW_UNKNOWN){
+		trace("missing command: %.*s", str->size, str->ptr);
+		return;
+	}
+
+	uint64_t start = redraw_profile.enabled ? now_ns() : 0;
+	if (!redraw_cmds[cmd].ptr(iarg)){
+		trace("parsing failed on redraw(%s):%.*s", redraw_cmds[cmd].lbl, str->size, str->ptr);
+	}
+
+	if (start)
+		redraw_profile_add(REDRAW_DECODE, cmd, start, iarg->size - 1);
+}
+
 static void nvim_redraw(const msgpack_object_array* arg)
 {
-	trace("redraw");
+	trace_ev(TRACE_REDRAW, 0, arg->size, 0, 0);
 /* format should be an array of arrays where each inner array is
  * cmd -> arguments */
 	for (size_t i = 0; i < arg->size; i++){
 		if (arg->ptr[i].type != MSGPACK_OBJECT_ARRAY)
 			continue;
-		const msgpack_object_array* iarg = &arg->ptr[i].via.array;
 
-		if (iarg->ptr[0].type != MSGPACK_OBJECT_STR){
-			trace("bad arg");
-			continue;
+		redraw_event(&arg->ptr[i].via.array);
+	}
+}
+
+static void on_notification(msgpack_object_str* cmd, const msgpack_object_array* arg)
+{
+	if (nvim_str_match(cmd, "redraw")){
+		if (!nvim.frame_start)
+			nvim.frame_start = now_ns();
+		nvim_redraw(arg);
+	}
+/* win-close, win-hide : find grid, close it (unless primary) */
+	else{
+		trace("unhandled-notification: %.*s", (int) cmd->size, cmd->ptr);
+	}
+}
+
+enum read_status {
+	READ_OK = 0,
+	READ_AGAIN = 1,
+	READ_DEAD = 2
+};
+
+/*
+ * data from nvim is read into [buf] and framed with mpull_skip, complete
+ * messages are either decoded in place (redraw, see pull_redraw) or unpacked
+ * into [result] - which reuses its zone between calls. Strings in [result]
+ * point into [buf], [next] is where the message being processed ends.
+ */
+static struct {
+	uint8_t* buf;
+	size_t used, cap;
+	size_t next;
+	bool claimed;
+	msgpack_unpacked result;
+} reader;
+
+static bool setup_reader()
+{
+	reader.cap = 65536;
+	metric_set(&nvim.stats.read_buffer, reader.cap);
+	reader.buf = malloc(reader.cap);
+	if (!reader.buf)
+		return false;
+
+	msgpack_unpacked_init(&reader.result);
+	return true;
+}
+
+/*
+ * for a response callback that wants to keep what it got without copying:
+ * takes over the read buffer and the zone of the message being processed
+ * (free them with free / msgpack_zone_free), the rest of the buffer moves to
+ * a new one. False, with nothing taken, if that can't be allocated.
+ */
+static bool reader_claim(uint8_t** buf, msgpack_zone** zone)
+{
+	uint8_t* rest = malloc(reader.cap);
+	if (!rest)
+		return false;
+
+	reader.used -= reader.next;
+	memcpy(rest, &reader.buf[reader.next], reader.used);
+
+	*buf = reader.buf;
+	*zone = msgpack_unpacked_release_zone(&reader.result);
+	reader.buf = rest;
+	reader.next = 0;
+	reader.claimed = true;
+	return true;
+}
+
+static void process_message(const msgpack_object* const o)
+{
+	const msgpack_object_array* const args = &(o->via.array);
+
+	if (args->size != 3 && args->size != 4){
+		trace("invalid object size");
+		return;
+	}
+
+	trace_ev(TRACE_MESSAGE, 0, args->size, args->ptr[0].via.u64,
+		args->ptr[1].type == MSGPACK_OBJECT_POSITIVE_INTEGER ? args->ptr[1].via.u64 : 0);
+
+	switch(args->ptr[0].via.u64){
+	case 0:
+		trace("request");
+	break;
+/* [1, msgid, error, result] */
+	case 1:
+		if (args->size == 4 && args->ptr[1].type == MSGPACK_OBJECT_POSITIVE_INTEGER)
+			rpc_response(args->ptr[1].via.u64, &args->ptr[2], &args->ptr[3]);
+		else
+			trace("malformed response");
+	break;
+	case 2:
+		if (args->ptr[1].type == MSGPACK_OBJECT_STR &&
+				args->ptr[2].type == MSGPACK_OBJECT_ARRAY){
+			on_notification(&args->ptr[1].via.str, &args->ptr[2].via.array);
 		}
+		else
+			fprintf(stderr, "unknown notification format\n");
+	break;
+	default:
+		fprintf(stderr, "unknown identifier: %"PRIu64, args->ptr[0].via.u64);
+	break;
+	}
+}
 
-		const msgpack_object_str* str = &iarg->ptr[0].via.str;
-		bool found = false;
-		for (size_t j = 0; j < COUNT_OF(redraw_cmds); j++){
-			if (nvim_str_match(str, redraw_cmds[j].lbl)){
-				found = true;
+/*
+ * Recording format, in host byte order:
+ *  header: RECORD_MAGIC (8 bytes)
+ *  records: [u64 ns since the start of the recording][u32 length][bytes]
+ * where the bytes are whatever a single read from the nvim pipe returned.
+ */
+#define RECORD_MAGIC "NVARREC1"
 
-				if (!redraw_cmds[j].ptr(iarg)){
-					trace("parsing failed on redraw(%s):%.*s", redraw_cmds[j].lbl, str->size, str->ptr);
-				}
+static void record(const uint8_t* buf, size_t len)
+{
+	uint64_t ts = now_ns() - nvim.record_start;
+	uint32_t len32 = len;
+
+	if (1 != fwrite(&ts, sizeof(ts), 1, nvim.record_out) ||
+		1 != fwrite(&len32, sizeof(len32), 1, nvim.record_out) ||
+		1 != fwrite(buf, len, 1, nvim.record_out)){
+		trace("record: write failed, stopping");
+		fclose(nvim.record_out);
+		nvim.record_out = NULL;
+	}
+}
 
-				break;
+/*
+ * grid_line fast path, [c] is positioned at the first [grid, row, col, cells]
+ * tuple of the event and the cells are turned into draw operations straight
+ * from the read buffer - the same thing draw_lines does from an object tree
+ */
+static bool pull_grid_line(struct mpull* c, uint32_t n_lines)
+{
+	for (uint32_t i = 0; i < n_lines; i++){
+		uint32_t n, n_cells;
+		uint64_t grid, row, col;
+
+/* newer versions append a 'wrap' flag, ignore anything past cells */
+		if (!mpull_array(c, &n) || n < 4 ||
+			!mpull_uint(c, &grid) || !mpull_uint(c, &row) ||
+			!mpull_uint(c, &col) || !mpull_array(c, &n_cells))
+			return false;
+
+		trace_ev(TRACE_GRID_LINE, grid, n_cells, row, col);
+		push_op((struct draw_op){
+			.kind = OP_LINE,
+			.grid = grid,
+			.pos = {.row = row, .col = col}
+		});
+
+		for (uint32_t j = 0; j < n_cells; j++){
+			uint32_t sz;
+			msgpack_object_str str;
+			uint64_t id = CELL_HL_KEEP;
+			uint64_t count = 1;
+
+			if (!mpull_array(c, &sz) || !sz || !mpull_str(c, &str.ptr, &str.size))
+				return false;
+
+			if (sz > 1 && !mpull_uint(c, &id))
+				return false;
+
+			if (sz > 2 && !mpull_uint(c, &count))
+				return false;
+
+			for (uint32_t k = 3; k < sz; k++){
+				if (mpull_skip(c) != MPULL_OK)
+					return false;
 			}
+
+			if (count > UINT32_MAX)
+				count = UINT32_MAX;
+
+			push_op((struct draw_op){
+				.kind = OP_CELL,
+				.grid = grid,
+				.cell = {
+					.ch = cell_codepoint(&str),
+					.count = count,
+					.hl = id
+				}
+			});
+			metric_add(&nvim.stats.cells_received, count);
 		}
 
-		if (!found){
-			trace("missing command: %.*s", str->size, str->ptr);
+		for (uint32_t k = 4; k < n; k++){
+			if (mpull_skip(c) != MPULL_OK)
+				return false;
 		}
 	}
+
+	return true;
 }
 
-static void on_notification(msgpack_object_str* cmd, const msgpack_object_array* arg)
+/*
+ * decode a complete message if it is a redraw notification, grid_line events
+ * are handled in place and the others are unpacked one by one and go through
+ * redraw_event. Returns false (and does nothing) for any other message.
+ */
+static bool pull_redraw(const uint8_t* buf, size_t len)
 {
-	if (nvim_str_match(cmd, "redraw")){
+	struct mpull c = {.pos = buf, .end = buf + len};
+	uint32_t n, n_events;
+	uint64_t type;
+	const char* name;
+	uint32_t name_len;
+
+	if (!mpull_array(&c, &n) || n != 3 ||
+		!mpull_uint(&c, &type) || type != 2 ||
+		!mpull_str(&c, &name, &name_len) ||
+		name_len != 6 || memcmp(name, "redraw", 6) != 0 ||
+		!mpull_array(&c, &n_events))
+		return false;
 
-/* first try without the slowpath, if it can't be done, send the wakeup
- * command to break out of poll, and then the render thread will stick to
- * the hold- lock, process the command and then release all held locks */
-		if (!nvim.lock_level){
-			nvim.lock_level = 1;
-
-			if (0 != pthread_mutex_trylock(&nvim.synch)){
-				pthread_mutex_lock(&nvim.hold);
-				nvim.lock_level = 2;
-				char cmd = 'l';
-				write(nvim.sigfd, &cmd, 1);
-				pthread_mutex_lock(&nvim.synch);
-			}
+	if (!nvim.frame_start)
+		nvim.frame_start = now_ns();
+
+	trace_ev(TRACE_REDRAW, 0, n_events, 0, 0);
+	for (uint32_t i = 0; i < n_events; i++){
+		const uint8_t* start = c.pos;
+		uint32_t n_args;
+		msgpack_object_str cmd;
+		bool failed = false;
+
+		if (mpull_array(&c, &n_args) && n_args &&
+			mpull_str(&c, &cmd.ptr, &cmd.size) &&
+			redraw_lookup(&cmd) == REDRAW_GRID_LINE){
+			metric_add(&redraw_hits[REDRAW_GRID_LINE], 1);
+			trace_ev(TRACE_REDRAW_EVENT, 0, n_args - 1, REDRAW_GRID_LINE, 0);
+			uint64_t start = redraw_profile.enabled ? now_ns() : 0;
+			bool ok = pull_grid_line(&c, n_args - 1);
+			if (start)
+				redraw_profile_add(REDRAW_DECODE,
+					REDRAW_GRID_LINE, start, n_args - 1);
+			if (ok)
+				continue;
+
+			trace("parsing failed on redraw(grid_line)");
+			failed = true;
 		}
 
-		nvim_redraw(arg);
+/* the message is known to be complete, so this can't come up short */
+		c.pos = start;
+		if (mpull_skip(&c) != MPULL_OK || failed)
+			continue;
+
+		size_t off = 0;
+		if (MSGPACK_UNPACK_SUCCESS == msgpack_unpack_next(&reader.result,
+			(const char*) start, c.pos - start, &off) &&
+			reader.result.data.type == MSGPACK_OBJECT_ARRAY){
+			redraw_event(&reader.result.data.via.array);
+		}
 	}
-/* win-close, win-hide : find grid, close it (unless primary) */
-	else{
-		trace("unhandled-notification: %s", cmd->ptr);
+
+	return true;
+}
+
+/* process every complete message that has been read, false if there is
+ * something that isn't msgpack */
+static bool reader_process()
+{
+	size_t ofs = 0;
+
+	while (ofs < reader.used){
+		struct mpull c = {
+			.pos = &reader.buf[ofs],
+			.end = &reader.buf[reader.used]
+		};
+
+		enum mpull_status st = mpull_skip(&c);
+		if (st == MPULL_SHORT)
+			break;
+
+		if (st == MPULL_BAD){
+			trace("malformed message from nvim");
+			return false;
+		}
+
+		const uint8_t* msg = &reader.buf[ofs];
+		size_t len = c.pos - msg;
+		ofs += len;
+
+		if (pull_redraw(msg, len))
+			continue;
+
+		size_t off = 0;
+		if (MSGPACK_UNPACK_SUCCESS == msgpack_unpack_next(
+			&reader.result, (const char*) msg, len, &off)){
+			reader.next = ofs;
+			process_message(&reader.result.data);
+
+/* the buffer was taken, what was after the message is at the start of the
+ * new one */
+			if (reader.claimed){
+				reader.claimed = false;
+				ofs = 0;
+			}
+		}
 	}
+
+	memmove(reader.buf, &reader.buf[ofs], reader.used - ofs);
+	reader.used -= ofs;
+
+	return true;
 }
 
-static int mpack_to_nvim(void* data, const char* buf, unsigned long buf_out)
+/*
+ * read what is available on [fdin] and process every complete message, used
+ * by the input thread (blocking) and the main loop in single-threaded mode
+ * (non-blocking, READ_AGAIN when drained)
+ */
+static enum read_status read_nvim(int fdin)
 {
-	FILE* fpek = data;
-	fwrite(buf, buf_out, 1, fpek);
-	fflush(fpek);
-	return 0;
+/* make sure we can accomodate ~64k more, otherwise grow - since we are
+ * running in RPC like mode we don't really know how much data there is
+ * without parsing. A partial message is rescanned on every read, so grow by
+ * at least what is buffered to keep that linear in the message size. */
+	size_t want = reader.used > 65536 ? reader.used : 65536;
+	if (reader.cap - reader.used < want){
+		size_t cap = reader.used + want;
+		uint8_t* buf = realloc(reader.buf, cap);
+		if (!buf)
+			return READ_DEAD;
+		reader.buf = buf;
+		reader.cap = cap;
+		metric_set(&nvim.stats.read_buffer, cap);
+	}
+
+	ssize_t nr;
+	if (-1 == (nr = read(fdin, &reader.buf[reader.used], reader.cap - reader.used))){
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return READ_AGAIN;
+		if (errno == EINTR)
+			return READ_OK;
+		trace("read error: %d", errno);
+		return READ_DEAD;
+	}
+
+/* pipe dead */
+	if (0 == nr){
+		trace("dead-read");
+		return READ_DEAD;
+	}
+
+	if (nvim.record_out)
+		record(&reader.buf[reader.used], nr);
+
+	reader.used += nr;
+	metric_add(&nvim.stats.bytes_in, nr);
+	trace_ev(TRACE_READ, 0, nr, reader.used, 0);
+
+	return reader_process() ? READ_OK : READ_DEAD;
 }
 
 static void* thread_input(void* data)
@@ -1192,107 +3724,133 @@ static void* thread_input(void* data)
 	int* fdbuf = data;
 	int fdin = fdbuf[0];
 
-	static msgpack_unpacker unpack;
-	msgpack_unpacker_init(&unpack, MSGPACK_UNPACKER_INIT_BUFFER_SIZE);
+	while (read_nvim(fdin) != READ_DEAD){}
 
-/* looking at the unpacked code, it seems to self- invoke destroy on
- * unpacker_next calls, afact this should then release the zones from
- * unpack */
-	msgpack_unpacked result;
-	msgpack_unpacked_init(&result);
-
-	for(;;){
-	/* make sure we can accomodate ~64k more, otherwise grow - since we are
-	 * running in RPC like mode we don't really know how much data there is
-	 * without parsing */
-		ssize_t sz = msgpack_unpacker_buffer_capacity(&unpack);
-		if (sz < 65536){
-			if (!msgpack_unpacker_reserve_buffer(&unpack, 65536))
+/* release the ui thread */
+	close(fdin);
+	atomic_store(&nvim.quit, true);
+	wake_render();
+
+	return NULL;
+}
+
+struct replay_feed {
+	FILE* in;
+	int fd;
+};
+
+/* write the recorded reads into [fd] as they happened (paced) or as fast as
+ * the reader will take them, closing it at the end stops the client */
+static void* thread_replay(void* data)
+{
+	struct replay_feed* feed = data;
+	uint8_t* buf = NULL;
+	size_t cap = 0;
+	uint64_t ts;
+	uint32_t len;
+
+	nvim.replay.start = now_ns();
+
+	while (1 == fread(&ts, sizeof(ts), 1, feed->in) &&
+		1 == fread(&len, sizeof(len), 1, feed->in)){
+		if (len > cap){
+			uint8_t* nbuf = realloc(buf, len);
+			if (!nbuf)
 				break;
-			sz = msgpack_unpacker_buffer_capacity(&unpack);
+			buf = nbuf;
+			cap = len;
 		}
 
-		void* buffer = msgpack_unpacker_buffer(&unpack);
-		ssize_t nr;
-		if (-1 == (nr = read(fdin, buffer, sz))){
-			if (errno == EAGAIN || errno == EINTR)
-				continue;
-			trace("read error: %d", errno);
+		if (len && 1 != fread(buf, len, 1, feed->in))
 			break;
+
+		if (nvim.replay.paced){
+			uint64_t now = now_ns() - nvim.replay.start;
+			if (ts > now){
+				uint64_t ns = ts - now;
+				nanosleep(&(struct timespec){
+					.tv_sec = ns / 1000000000ull,
+					.tv_nsec = ns % 1000000000ull
+				}, NULL);
+			}
 		}
 
-/* pipe dead */
-		if (0 == nr){
-			trace("dead-read");
-			break;
+		for (size_t ofs = 0; ofs < len;){
+			ssize_t nw = write(feed->fd, &buf[ofs], len - ofs);
+			if (-1 == nw){
+				if (errno == EINTR)
+					continue;
+				goto out;
+			}
+			ofs += nw;
 		}
+	}
 
-		msgpack_unpacker_buffer_consumed(&unpack, nr);
+out:
+	free(buf);
+	fclose(feed->in);
+	close(feed->fd);
+	free(feed);
+	return NULL;
+}
 
-		int res;
-		while (MSGPACK_UNPACK_SUCCESS ==
-			(res = msgpack_unpacker_next(&unpack, &result))){
-			const msgpack_object* const o = &result.data;
-			const msgpack_object_array* const args = &(o->via.array);
+/* the replay counterpart to setup_nvim_process, outgoing requests go nowhere */
+static bool setup_replay(const char* path, int* in, int* out)
+{
+	FILE* fin = fopen(path, "r");
+	if (!fin)
+		return false;
 
-			if (nvim.trace_out){
-				msgpack_object_print(nvim.trace_out, *o);
-				trace_obj_array(args);
-				fputs("\n", nvim.trace_out);
-				fflush(nvim.trace_out);
-			}
+	char magic[8];
+	if (1 != fread(magic, sizeof(magic), 1, fin) ||
+		memcmp(magic, RECORD_MAGIC, sizeof(magic)) != 0){
+		fclose(fin);
+		return false;
+	}
 
- 			if (args->size != 3 && args->size != 4){
-				fprintf(nvim.trace_out, "invalid object size");
-				continue;
-			}
-			switch(args->ptr[0].via.u64){
-			case 0:
-				trace("request");
-			break;
-/* didn't find a good source on the reply format, be careful here when
- * adding more request types where the response is interesting */
-			case 1:
-				for (size_t i = 0; i < COUNT_OF(nvim.pending); i++){
-
-/* another open question here is what happens with buffering / chunking,
- * do we get arbitrarily long files */
-					if (nvim.pending[i].reqid ==
-						args->ptr[1].via.u64 && nvim.pending[i].data &&
-						args->size == 4 && args->ptr[3].type == MSGPACK_OBJECT_ARRAY){
-						nvim.pending[i].data(i, &args->ptr[3].via.array);
-						nvim.pending[i].reqid = 0;
-						break;
-					}
-				}
-			break;
-			case 2:
- 			if (args->ptr[1].type == MSGPACK_OBJECT_STR &&
-						args->ptr[2].type == MSGPACK_OBJECT_ARRAY){
-					on_notification(&args->ptr[1].via.str, &args->ptr[2].via.array);
-				}
-				else
-					fprintf(stderr, "unknown notification format\n");
-			break;
-			default:
-				fprintf(stderr, "unknown identifier: %"PRIu64, args->ptr[0].via.u64);
-			break;
-			}
-		}
+	int pipes[2];
+	if (-1 == pipe(pipes)){
+		fclose(fin);
+		return false;
+	}
+
+	*out = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	struct replay_feed* feed = malloc(sizeof(struct replay_feed));
+	if (-1 == *out || !feed){
+		free(feed);
+		goto fail;
+	}
+
+	*feed = (struct replay_feed){
+		.in = fin,
+		.fd = pipes[1]
+	};
+	*in = pipes[0];
+
+	pthread_t pth;
+	pthread_attr_t pthattr;
+	pthread_attr_init(&pthattr);
+	pthread_attr_setdetachstate(&pthattr, PTHREAD_CREATE_DETACHED);
+
+	if (0 != pthread_create(&pth, &pthattr, thread_replay, feed)){
+		free(feed);
+		close(*out);
+		goto fail;
 	}
 
-/* release the ui thread */
-	close(fdin);
-	char cmd = 'q';
-	write(nvim.sigfd, &cmd, 1);
+	return true;
 
-	return NULL;
+fail:
+	fclose(fin);
+	close(pipes[0]);
+	close(pipes[1]);
+	return false;
 }
 
-static bool setup_nvim_process(int argc, char** argv, int* in, FILE** out)
+static bool setup_nvim_process(int argc, char** argv, int* in, int* out)
 {
-/* pipe-pair and map to new process stdin/stdout, wrap around FILE abstractions
- * for use here - process input in one pipe, output in the other */
+/* pipe-pair and map to new process stdin/stdout - process input in one pipe,
+ * output in the other */
 	int pipe_input[2];
 	int pipe_output[2];
 
@@ -1306,18 +3864,13 @@ static bool setup_nvim_process(int argc, char** argv, int* in, FILE** out)
 		close(pipe_output[1]);
 		return false;
 	}
-	if (!(*out = fdopen(pipe_input[1], "w"))){
-		close(*in);
-		close(pipe_input[0]);
-		close(pipe_input[1]);
-		return false;
-	}
+	*out = pipe_input[1];
 
 	pid_t nvim_pid = fork();
 
 	if (0 == nvim_pid){
 		close(*in);
-		fclose(*out);
+		close(*out);
 
 		if (-1 == dup2(pipe_input[0], STDIN_FILENO) ||
 			-1 == dup2(pipe_output[1], STDOUT_FILENO)){
@@ -1329,7 +3882,7 @@ static bool setup_nvim_process(int argc, char** argv, int* in, FILE** out)
 		sigset_t block;
 		sigemptyset(&block);
 		sigaddset(&block, SIGINT);
-		sigprocmask(SIG_BLOCK, &block, NULL);
+		sigprocmask(SIG_SETMASK, &block, NULL);
 
 		char* out_argv[argc+4];
 		size_t ofs = 0;
@@ -1351,7 +3904,7 @@ static bool setup_nvim_process(int argc, char** argv, int* in, FILE** out)
 
 	if (-1 == nvim_pid){
 		close(*in);
-		fclose(*out);
+		close(*out);
 		return false;
 	}
 
@@ -1425,13 +3978,11 @@ static void setup_nvim_ui()
 	}
 }
 
-static struct tui_cbcfg setup_nvim(int id)
-{
-	struct nvim_meta* nvim_grid = malloc(sizeof(struct nvim_meta));
-	*nvim_grid = (struct nvim_meta){
-		.grid_id = id
-	};
+static bool on_subwindow(struct tui_context* T,
+	arcan_tui_conn* conn, uint32_t id, uint8_t type, void* t);
 
+static struct tui_cbcfg setup_nvim(struct nvim_meta* nvim_grid)
+{
 	struct tui_cbcfg cbcfg = {
 		.query_label = query_label,
 		.input_label = on_label,
@@ -1448,34 +3999,617 @@ static struct tui_cbcfg setup_nvim(int id)
 		.tick = on_tick,
 		.utf8 = on_utf8_paste,
 		.resized = on_resize,
+		.subwindow = on_subwindow,
 		.tag = nvim_grid
 	};
 
 	return cbcfg;
 }
 
+static void apply_defattr_tui(struct tui_context* T, struct tui_screen_attr attr)
+{
+	arcan_tui_set_color(T, TUI_COL_PRIMARY, attr.fc);
+	arcan_tui_set_bgcolor(T, TUI_COL_PRIMARY, attr.bc);
+
+	arcan_tui_set_color(T, TUI_COL_TEXT, attr.fc);
+	arcan_tui_set_bgcolor(T, TUI_COL_TEXT, attr.bc);
+
+	arcan_tui_set_bgcolor(T, TUI_COL_BG, attr.bc);
+	arcan_tui_set_color(T, TUI_COL_BG, attr.bc);
+	arcan_tui_defattr(T, &attr);
+}
+
+static void apply_defattr(struct tui_screen_attr attr)
+{
+	size_t pos = 0;
+	struct nvim_meta* m;
+	while ((m = grids_next(&pos))){
+		if (m->tui)
+			apply_defattr_tui(m->tui, attr);
+	}
+}
+
+static void apply_grid(struct tui_context* T, struct nvim_meta* grid_meta)
+{
+	struct shadow_grid* back = &grid_meta->back;
+	struct shadow_grid* screen = &grid_meta->screen;
+
+/* if the context has changed size we can't trust what we think is on the
+ * screen, so repaint everything we have */
+	size_t rows, cols;
+	arcan_tui_dimensions(T, &rows, &cols);
+	bool full = false;
+
+	if (screen->rows != rows || screen->cols != cols){
+		struct tui_screen_attr attr = {0};
+		if (!shadow_resize(screen, cols, rows, &attr))
+			return;
+		full = true;
+	}
+
+	if (rows > back->rows)
+		rows = back->rows;
+	if (cols > back->cols)
+		cols = back->cols;
+
+	for (size_t row = 0; row < rows; row++){
+		if (!full && !shadow_row_dirty(back, row))
+			continue;
+
+		struct shadow_cell* cells = shadow_row(back, row);
+		struct shadow_cell* cur = shadow_row(screen, row);
+		size_t lo = full ? 0 : back->span[row].lo;
+		size_t hi = full ? cols : back->span[row].hi;
+		if (hi > cols)
+			hi = cols;
+
+/* only reposition when there is a gap between changed cells */
+		size_t next = (size_t) -1;
+		for (size_t col = lo; col < hi; col++){
+			if (!full && shadow_cell_equal(&cells[col], &cur[col]))
+				continue;
+
+			if (col != next)
+				arcan_tui_move_to(T, col, row);
+
+/* this might be a bug with tui, investigate - sometimes cells with
+ * zero content won't get cleared / updated, this might be tied to some
+ * terminal emulator visual leftovers we have had in the past */
+			arcan_tui_write(T, cells[col].ch ? cells[col].ch : ' ', &cells[col].attr);
+			cur[col] = cells[col];
+			next = col + 1;
+			metric_add(&nvim.stats.cells_written, 1);
+		}
+	}
+
+	shadow_clean(back);
+
+/* restore known cursor position, not doing this caused the
+ * cursor to sometimes look like it was stuck at end of line */
+	arcan_tui_move_to(T, back->cx, back->cy);
+}
+
+/* render thread state for applying draw operations */
+static struct {
+/* position and attribute of the grid_line being applied */
+	struct {
+		struct nvim_meta* grid;
+		size_t row, col;
+		struct tui_screen_attr attr;
+	} line;
+
+/* applied to the tui contexts on the next flush */
+	bool defattr_dirty;
+	char* title;
+
+/* oldest flush (and key) applied since the last arcan_tui_refresh */
+	struct {
+		uint64_t flush;
+		uint64_t key;
+	} refresh;
+} render;
+
+static struct nvim_meta* grid_meta(uint32_t grid)
+{
+	struct nvim_meta* m = grids_get(grid);
+	if (!m)
+		trace("unknown grid %"PRIu32, grid);
+	return m;
+}
+
+/*
+ * grid_resize for a grid we haven't seen. The subwindow for it arrives
+ * asynchronously (on_subwindow) if at all, until then everything is drawn to
+ * the shadow grid only - which is then repainted in full on the first flush
+ * after, as the screen copy doesn't match the size of the new context.
+ */
+static struct nvim_meta* grid_create(uint32_t grid)
+{
+	struct nvim_meta* m = malloc(sizeof(struct nvim_meta));
+	if (!m)
+		return NULL;
+
+	*m = (struct nvim_meta){
+		.grid_id = grid,
+		.wnd_id = ++nvim.wnd_id
+	};
+
+	if (!u32map_insert(&nvim.grids, grid, &m)){
+		free(m);
+		return NULL;
+	}
+
+/* without ext_multigrid nvim only ever draws to grid 1 */
+	if (nvim.multigrid)
+		arcan_tui_request_subwnd(nvim.tui, TUI_WND_TUI, m->wnd_id);
+
+	return m;
+}
+
+static void grid_destroy(uint32_t grid)
+{
+/* the default grid is never destroyed, it is the primary context */
+	if (grid == 1)
+		return;
+
+	struct nvim_meta* m;
+	if (!u32map_take(&nvim.grids, grid, &m))
+		return;
+
+	if (render.line.grid == m)
+		render.line.grid = NULL;
+
+/* any input held back for the grid goes with it */
+	if (m->tui)
+		arcan_tui_destroy(m->tui, NULL);
+	shadow_free(&m->back);
+	shadow_free(&m->screen);
+	free(m);
+}
+
+static bool on_subwindow(struct tui_context* T,
+	arcan_tui_conn* conn, uint32_t id, uint8_t type, void* t)
+{
+/* match it to the grid that asked for it, which may be gone already */
+	size_t pos = 0;
+	struct nvim_meta* m;
+	while ((m = grids_next(&pos))){
+		if (!m->tui && m->wnd_id == id)
+			break;
+	}
+
+	if (!m || type != TUI_WND_TUI)
+		return false;
+
+	struct tui_cbcfg cbcfg = setup_nvim(m);
+	m->tui = arcan_tui_setup(conn, T, &cbcfg, sizeof(cbcfg));
+	if (!m->tui)
+		return false;
+
+	arcan_tui_set_flags(m->tui, TUI_MOUSE_FULL);
+	apply_defattr_tui(m->tui, nvim.defattr);
+	return true;
+}
+
+/*
+ * OP_FLUSH, write the changes to each grid out to their respective tui
+ * contexts along with any pending title / color changes
+ */
+static void apply_frame(const struct draw_op* op)
+{
+	uint64_t start = now_ns();
+	uint64_t frame_start = op->flush.frame_start;
+	uint64_t cells = metric_get(&nvim.stats.cells_written);
+
+	if (op->flush.key){
+		hist_add(&nvim.latency.key_flush, op->flush.received - op->flush.key);
+		if (!render.refresh.key)
+			render.refresh.key = op->flush.key;
+	}
+
+	if (!render.refresh.flush)
+		render.refresh.flush = op->flush.received;
+
+	if (frame_start){
+		uint64_t ns = now_ns() - frame_start;
+		metric_add(&nvim.stats.frames, 1);
+		metric_add(&nvim.stats.frame_ns, ns);
+		if (ns > metric_get(&nvim.stats.frame_ns_max))
+			metric_set(&nvim.stats.frame_ns_max, ns);
+	}
+
+	if (render.defattr_dirty){
+		apply_defattr(nvim.defattr);
+		render.defattr_dirty = false;
+	}
+
+	if (render.title){
+		arcan_tui_ident(nvim.tui, render.title);
+		free(render.title);
+		render.title = NULL;
+	}
+
+	size_t pos = 0;
+	struct nvim_meta* m;
+	while ((m = grids_next(&pos))){
+		if (m->tui)
+			apply_grid(m->tui, m);
+	}
+
+	uint64_t ns = now_ns() - start;
+	trace_ev(TRACE_FRAME, 0,
+		metric_get(&nvim.stats.cells_written) - cells, ns, 0);
+	metric_add(&nvim.stats.flushes, 1);
+	metric_add(&nvim.stats.flush_ns, ns);
+	if (ns > metric_get(&nvim.stats.flush_ns_max))
+		metric_set(&nvim.stats.flush_ns_max, ns);
+}
+
+static void apply_hl_define(const struct draw_op* op)
+{
+	if (!highlight_reserve(op->hl.id)){
+		trace("hl_attr_define: couldn't grow table to %"PRIu32, op->hl.id);
+		return;
+	}
+
+	struct hl_state* state = &highlights.state[op->hl.id];
+	if (!state->defined)
+		metric_add(&nvim.stats.hl_defined, 1);
+
+	*state = (struct hl_state){
+		.attr = nvim.defattr,
+		.got_fg = op->hl.got_fg,
+		.got_bg = op->hl.got_bg,
+		.defined = true
+	};
+
+	state->attr.aflags |= op->hl.aflags;
+	if (op->hl.got_fg)
+		update_cval(op->hl.fg, state->attr.fc);
+	if (op->hl.got_bg)
+		update_cval(op->hl.bg, state->attr.bc);
+
+	highlight_resolve(op->hl.id);
+}
+
+static void apply_op(const struct draw_op* op)
+{
+	struct nvim_meta* m;
+
+	switch (op->kind){
+	case OP_RESIZE:
+		m = grids_get(op->grid);
+		if (!m && !(m = grid_create(op->grid))){
+			trace("grid_resize: couldn't add grid %"PRIu32, op->grid);
+			break;
+		}
+		if (!shadow_resize(&m->back, op->resize.cols, op->resize.rows, &nvim.defattr))
+			trace("grid_resize: couldn't allocate shadow grid");
+	break;
+	case OP_CLEAR:
+		if ((m = grid_meta(op->grid)))
+			shadow_clear(&m->back, &nvim.defattr);
+	break;
+	case OP_DESTROY:
+		grid_destroy(op->grid);
+	break;
+	case OP_LINE:
+		render.line.grid = grid_meta(op->grid);
+		render.line.row = op->pos.row;
+		render.line.col = op->pos.col;
+		render.line.attr = nvim.defattr;
+	break;
+	case OP_CELL:
+		if (!render.line.grid)
+			break;
+
+		if (op->cell.hl != CELL_HL_KEEP){
+			if (op->cell.hl < highlights.count)
+				render.line.attr = highlights.attr[op->cell.hl];
+			else {
+				trace("missing highlight attribute: %"PRIu64, op->cell.hl);
+				render.line.attr = nvim.defattr;
+			}
+		}
+
+		render.line.col = shadow_write(&render.line.grid->back, render.line.col,
+			render.line.row, op->cell.ch, &render.line.attr, op->cell.count);
+	break;
+	case OP_SCROLL:
+		if (!(m = grid_meta(op->grid)))
+			break;
+
+		shadow_scroll(&m->back, op->scroll.top, op->scroll.bottom,
+			op->scroll.left, op->scroll.right, op->scroll.rows);
+
+/* the rows that stayed on screen, rather than the exposed ones */
+		size_t moved = op->scroll.rows < 0 ? -op->scroll.rows : op->scroll.rows;
+		if (op->scroll.bottom > op->scroll.top + moved)
+			metric_add(&nvim.stats.scroll_rows,
+				op->scroll.bottom - op->scroll.top - moved);
+	break;
+	case OP_CURSOR:
+		if (!(m = grid_meta(op->grid)))
+			break;
+
+		m->back.cx = op->pos.col;
+		m->back.cy = op->pos.row;
+	break;
+	case OP_HL_DEFINE:
+		apply_hl_define(op);
+	break;
+	case OP_DEFAULT_COLORS:{
+		struct tui_screen_attr attr = {0};
+		update_cval(op->colors.fg, attr.fc);
+		update_cval(op->colors.bg, attr.bc);
+		nvim.defattr = attr;
+
+/* every entry that lacks fg or bg has the old default folded in */
+		for (size_t i = 0; i < highlights.count; i++)
+			highlight_resolve(i);
+		render.defattr_dirty = true;
+	}
+	break;
+	case OP_TITLE:
+		free(render.title);
+		render.title = op->title;
+	break;
+	case OP_FLUSH:
+		apply_frame(op);
+	break;
+	}
+}
+
+/*
+ * apply everything that has been queued so far, operations that arrive
+ * while draining are left for the next call so that a flood can't starve
+ * tui processing. Slots are handed back to the producer in batches.
+ */
+static void release_ops(size_t tail)
+{
+	atomic_store(&ring.tail, tail);
+	if (atomic_load_explicit(&ring.waiting, memory_order_relaxed) &&
+		atomic_exchange(&ring.waiting, false)){
+		uint64_t val = 1;
+		write(ring.space, &val, sizeof(val));
+	}
+}
+
+static void drain_ops()
+{
+	size_t tail = atomic_load_explicit(&ring.tail, memory_order_relaxed);
+	size_t head = atomic_load_explicit(&ring.head, memory_order_acquire);
+
+	while (tail != head){
+		const struct draw_op* op = &ring.ops[tail % OP_RING_SIZE];
+		uint64_t start = redraw_profile.enabled ? now_ns() : 0;
+		apply_op(op);
+		if (start)
+			redraw_profile_add(REDRAW_APPLY, op_cmds[op->kind], start, 0);
+		tail++;
+
+		if (tail % 1024 == 0)
+			release_ops(tail);
+	}
+
+	release_ops(tail);
+}
+
+/* the frames applied since the last refresh are now on their way out */
+static void latency_refreshed()
+{
+	if (!render.refresh.flush)
+		return;
+
+	uint64_t now = now_ns();
+	hist_add(&nvim.latency.flush_refresh, now - render.refresh.flush);
+	if (render.refresh.key)
+		hist_add(&nvim.latency.key_refresh, now - render.refresh.key);
+
+	render.refresh.flush = 0;
+	render.refresh.key = 0;
+}
+
+static void latency_dump(FILE* out)
+{
+	struct {
+		const char* name;
+		const struct hist* h;
+	} hists[] = {
+		{"key->flush", &nvim.latency.key_flush},
+		{"flush->refresh", &nvim.latency.flush_refresh},
+		{"key->refresh", &nvim.latency.key_refresh}
+	};
+
+	for (size_t i = 0; i < COUNT_OF(hists); i++){
+		const struct hist* h = hists[i].h;
+		fprintf(out, "latency %s: %"PRIu64" samples, p50 %.1f us, p99 %.1f us, "
+			"p99.9 %.1f us, max %.1f us\n", hists[i].name, h->count,
+			(double) hist_percentile(h, 50.0) / 1000.0,
+			(double) hist_percentile(h, 99.0) / 1000.0,
+			(double) hist_percentile(h, 99.9) / 1000.0,
+			(double) h->max / 1000.0);
+	}
+
+	pthread_mutex_lock(&nvim.rpc.lock);
+	for (size_t i = 0; i < nvim.n_rpc_methods; i++){
+		const struct hist* h = &nvim.rpc_methods[i].rtt;
+		fprintf(out, "rpc %s: %"PRIu64" answered, %"PRIu64" in flight, "
+			"%"PRIu64" errors, rtt p50 %.1f us, p99 %.1f us, max %.1f us\n",
+			nvim.rpc_methods[i].name, h->count,
+			metric_get(&nvim.rpc_methods[i].inflight),
+			metric_get(&nvim.rpc_methods[i].errors),
+			(double) hist_percentile(h, 50.0) / 1000.0,
+			(double) hist_percentile(h, 99.0) / 1000.0,
+			(double) h->max / 1000.0);
+	}
+	pthread_mutex_unlock(&nvim.rpc.lock);
+
+	fflush(out);
+}
+
+/* SIGUSR1 dumps the latency histograms, it is blocked in every thread and
+ * read through a signalfd that is processed along with the tui contexts -
+ * this has to happen before any thread is created */
+static void setup_dump_signal()
+{
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &mask, NULL);
+	nvim.latency.sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+}
+
+/*
+ * NVIM_ARCAN_METRICS=path: the metrics are served in the Prometheus text
+ * format on a unix socket at [path], each connection gets the current values
+ * and is closed (e.g. socat - UNIX-CONNECT:path)
+ */
+static void setup_metrics(const char* path)
+{
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	if (strlen(path) >= sizeof(addr.sun_path)){
+		trace("metrics: socket path too long");
+		return;
+	}
+	strcpy(addr.sun_path, path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (-1 == fd)
+		return;
+
+/* a stale socket from an earlier session would make bind fail, anything
+ * else at [path] is left alone and bind fails instead */
+	struct stat st;
+	if (0 == lstat(path, &st) && S_ISSOCK(st.st_mode))
+		unlink(path);
+	if (-1 == bind(fd, (struct sockaddr*) &addr, sizeof(addr)) ||
+		-1 == listen(fd, 4)){
+		trace("metrics: couldn't listen on %s: %d", path, errno);
+		close(fd);
+		return;
+	}
+
+	nvim.metrics.fd = fd;
+	nvim.metrics.path = path;
+
+	static const struct {
+		const char* name;
+		enum metric_kind kind;
+		_Atomic uint64_t* value;
+	} metrics[] = {
+		{"nvim_arcan_pipe_read_bytes_total", METRIC_COUNTER, &nvim.stats.bytes_in},
+		{"nvim_arcan_pipe_written_bytes_total", METRIC_COUNTER, &nvim.stats.bytes_out},
+		{"nvim_arcan_pipe_writes_total", METRIC_COUNTER, &nvim.stats.write_calls},
+		{"nvim_arcan_read_buffer_bytes", METRIC_GAUGE, &nvim.stats.read_buffer},
+		{"nvim_arcan_cells_received_total", METRIC_COUNTER, &nvim.stats.cells_received},
+		{"nvim_arcan_cells_written_total", METRIC_COUNTER, &nvim.stats.cells_written},
+		{"nvim_arcan_scroll_rows_total", METRIC_COUNTER, &nvim.stats.scroll_rows},
+		{"nvim_arcan_highlights_defined", METRIC_GAUGE, &nvim.stats.hl_defined},
+		{"nvim_arcan_highlight_slots", METRIC_GAUGE, &nvim.stats.hl_slots},
+		{"nvim_arcan_transfers_pending", METRIC_GAUGE, &nvim.stats.transfers},
+		{"nvim_arcan_ring_wait_ns_total", METRIC_COUNTER, &nvim.stats.ring_wait_ns},
+		{"nvim_arcan_frames_total", METRIC_COUNTER, &nvim.stats.frames},
+		{"nvim_arcan_frame_ns_total", METRIC_COUNTER, &nvim.stats.frame_ns},
+		{"nvim_arcan_flushes_total", METRIC_COUNTER, &nvim.stats.flushes},
+		{"nvim_arcan_flush_ns_total", METRIC_COUNTER, &nvim.stats.flush_ns},
+		{"nvim_arcan_keys_total", METRIC_COUNTER, &nvim.stats.keys},
+		{"nvim_arcan_key_requests_total", METRIC_COUNTER, &nvim.stats.key_requests},
+		{"nvim_arcan_mouse_dropped_total", METRIC_COUNTER, &nvim.stats.mouse_dropped},
+		{"nvim_arcan_mouse_requests_saved_total", METRIC_COUNTER,
+			&nvim.stats.mouse_requests_saved}
+	};
+
+	for (size_t i = 0; i < COUNT_OF(metrics); i++)
+		metric_register(metrics[i].name, NULL, NULL, metrics[i].kind, metrics[i].value);
+
+	for (size_t i = 0; i < COUNT_OF(redraw_cmds); i++)
+		metric_register("nvim_arcan_redraw_events_total", "event",
+			redraw_cmds[i].lbl, METRIC_COUNTER, &redraw_hits[i]);
+	metric_register("nvim_arcan_redraw_events_total", "event",
+		"unknown", METRIC_COUNTER, &redraw_hits[REDRAW_UNKNOWN]);
+
+	for (size_t i = 0; i < nvim.n_rpc_methods; i++)
+		rpc_method_metrics(i);
+}
+
+/* the whole snapshot is small enough for the socket buffer, so this doesn't
+ * block on a client that never reads */
+static void serve_metrics()
+{
+	int fd;
+	while (-1 != (fd = accept4(nvim.metrics.fd, NULL, NULL, SOCK_CLOEXEC))){
+		FILE* out = fdopen(fd, "w");
+		if (!out){
+			close(fd);
+			continue;
+		}
+
+		metrics_write(out);
+		fclose(out);
+	}
+}
+
 int main(int argc, char** argv)
 {
+	setup_dump_signal();
+
+/* a reader going away (export destination, nvim) is a write error instead */
+	signal(SIGPIPE, SIG_IGN);
+
 	arcan_tui_conn* conn = arcan_tui_open_display("NeoVim", "");
-	struct tui_cbcfg cbcfg = setup_nvim(1);
-	nvim.grids[0] = arcan_tui_setup(conn, NULL, &cbcfg, sizeof(cbcfg));
-	nvim.n_grids = 1;
-	arcan_tui_set_flags(nvim.grids[0], TUI_MOUSE_FULL);
+	struct nvim_meta* primary = malloc(sizeof(struct nvim_meta));
+	if (!primary || !u32map_insert(&nvim.grids, 1, &primary)){
+		fprintf(stderr, "failed to allocate grid\n");
+		return EXIT_FAILURE;
+	}
 
-	if (!nvim.grids[0]){
+	*primary = (struct nvim_meta){
+		.grid_id = 1
+	};
+
+	struct tui_cbcfg cbcfg = setup_nvim(primary);
+	nvim.tui = primary->tui = arcan_tui_setup(conn, NULL, &cbcfg, sizeof(cbcfg));
+
+	if (!nvim.tui){
 		fprintf(stderr, "failed to setup TUI connection\n");
 		return EXIT_FAILURE;
 	}
 
+	arcan_tui_set_flags(nvim.tui, TUI_MOUSE_FULL);
+	nvim.defattr = arcan_tui_defattr(nvim.tui, NULL);
+
 	const char* tracefn = getenv("NVIM_ARCAN_TRACE");
-	if (tracefn){
-		if (strcmp(tracefn, "-") == 0)
-			nvim.trace_out = stderr;
-		else
-			nvim.trace_out = fopen(tracefn, "w");
+	if (tracefn && !trace_open(tracefn))
+		fprintf(stderr, "couldn't open trace output %s\n", tracefn);
+
+	const char* profile = getenv("NVIM_ARCAN_PROFILE");
+	if (profile){
+		redraw_profile.summary = true;
+		redraw_profile.interval = strtoull(profile, NULL, 10) * 1000000000ull;
+		redraw_profile.last = now_ns();
+	}
+	redraw_profile.enabled = redraw_profile.summary || trace_enabled;
+
+	const char* transfer = getenv("NVIM_ARCAN_TRANSFER");
+	if (transfer && strcmp(transfer, "direct") == 0)
+		nvim.transfer = TRANSFER_DIRECT;
+	else if (transfer && strcmp(transfer, "stream") == 0)
+		nvim.transfer = TRANSFER_STREAM;
+
+	const char* metricsfn = getenv("NVIM_ARCAN_METRICS");
+	if (metricsfn)
+		setup_metrics(metricsfn);
+
+	const char* recordfn = getenv("NVIM_ARCAN_RECORD");
+	if (recordfn){
+		nvim.record_out = fopen(recordfn, "w");
+		if (nvim.record_out)
+			fwrite(RECORD_MAGIC, 8, 1, nvim.record_out);
+		nvim.record_start = now_ns();
 	}
 
-	FILE* data_out;
+	int data_out;
 	size_t argv_pos = 1;
 	while (argc > argv_pos){
 		if (strcmp("--multigrid", argv[argv_pos]) == 0){
@@ -1487,6 +4621,15 @@ int main(int argc, char** argv)
 		else if (strcmp("--messages", argv[argv_pos]) == 0){
 			nvim.messages = true;
 		}
+		else if (strcmp("--single-thread", argv[argv_pos]) == 0){
+			nvim.single_thread = true;
+		}
+		else if (strcmp("--replay", argv[argv_pos]) == 0 && argc > argv_pos + 1){
+			nvim.replay.path = argv[++argv_pos];
+		}
+		else if (strcmp("--paced", argv[argv_pos]) == 0){
+			nvim.replay.paced = true;
+		}
 /* forward to nvim at first unknown position */
 		else
 			break;
@@ -1496,75 +4639,236 @@ int main(int argc, char** argv)
 
 	int data_in[2] = {-1};
 
-	if (!setup_nvim_process(argc-1, &argv[argv_pos], &data_in[0], &data_out)){
-		arcan_tui_destroy(nvim.grids[0], "couldn't spawn neovim");
+	if (nvim.replay.path){
+		if (!setup_replay(nvim.replay.path, &data_in[0], &data_out)){
+			arcan_tui_destroy(nvim.tui, "couldn't open recording");
+			return EXIT_FAILURE;
+		}
+		nvim.transfer = TRANSFER_STREAM;
+	}
+	else if (!setup_nvim_process(argc-1, &argv[argv_pos], &data_in[0], &data_out)){
+		arcan_tui_destroy(nvim.tui, "couldn't spawn neovim");
 		return EXIT_FAILURE;
 	}
 
-	int pipes[2];
-	if (-1 == pipe(pipes)){
-		arcan_tui_destroy(nvim.grids[0], "signal pipe allocation failure");
+	if (!setup_reader()){
+		arcan_tui_destroy(nvim.tui, "couldn't allocate unpacker");
 		return EXIT_FAILURE;
 	}
-	nvim.sigfd = pipes[1];
-	int signalfd = pipes[0];
 
-	nvim.out = msgpack_packer_new(data_out, mpack_to_nvim);
+/* the fd we multiplex with the tui contexts is either the wakeup eventfd
+ * from the input thread or the nvim output pipe itself, followed by the
+ * latency dump signal and the metrics socket if those are set up */
+	int fdset[3];
+	size_t fdset_sz = 1;
+	uint32_t sig_bit = 0, metrics_bit = 0;
+	if (-1 != nvim.latency.sigfd){
+		sig_bit = 1 << fdset_sz;
+		fdset[fdset_sz++] = nvim.latency.sigfd;
+	}
+	if (-1 != nvim.metrics.fd){
+		metrics_bit = 1 << fdset_sz;
+		fdset[fdset_sz++] = nvim.metrics.fd;
+	}
+
+	int signalfd;
+	if (nvim.single_thread){
+		signalfd = data_in[0];
+		fcntl(signalfd, F_SETFL, fcntl(signalfd, F_GETFL) | O_NONBLOCK);
+	}
+	else {
+		nvim.wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		ring.space = eventfd(0, EFD_CLOEXEC);
+		if (-1 == nvim.wakeup || -1 == ring.space){
+			arcan_tui_destroy(nvim.tui, "wakeup eventfd allocation failure");
+			return EXIT_FAILURE;
+		}
+		signalfd = nvim.wakeup;
+	}
+	fdset[0] = signalfd;
+
+	nvim.outq.fd = data_out;
+	nvim.outq.threshold = 65536;
+	nvim.out = msgpack_packer_new(NULL, mpack_to_nvim);
 
 	setup_nvim_ui();
+	rpc_flush();
 
-	arcan_tui_announce_io(nvim.grids[0], false, NULL, "txt");
+	arcan_tui_announce_io(nvim.tui, false, NULL, "txt");
 
 /* create our input parsing thread */
-	pthread_t pth;
-	pthread_attr_t pthattr;
-	pthread_attr_init(&pthattr);
-	pthread_attr_setdetachstate(&pthattr, PTHREAD_CREATE_DETACHED);
-
-	if (-1 == pthread_create(&pth, &pthattr, thread_input, data_in)){
-		arcan_tui_destroy(nvim.grids[0], "input thread creation failed");
-		return EXIT_FAILURE;
+	if (!nvim.single_thread){
+		pthread_t pth;
+		pthread_attr_t pthattr;
+		pthread_attr_init(&pthattr);
+		pthread_attr_setdetachstate(&pthattr, PTHREAD_CREATE_DETACHED);
+
+		if (0 != pthread_create(&pth, &pthattr, thread_input, data_in)){
+			arcan_tui_destroy(nvim.tui, "input thread creation failed");
+			return EXIT_FAILURE;
+		}
 	}
 
-	while (1){
-		pthread_mutex_lock(&nvim.synch);
-		struct tui_process_res res =
-			arcan_tui_process(nvim.grids, nvim.n_grids, &signalfd, 1, -1);
-
-/* sweep the result bitmap and synch the grids that have changed */
-		if (res.errc == TUI_ERRC_OK){
-			if (-1 == arcan_tui_refresh(nvim.grids[0]) && errno == EINVAL)
-				break;
-		}
-		else{
+/* a transfer that is waiting for its destination to drain or for more data
+ * to read is retried on a short timeout, those fds aren't part of the set -
+ * wheel ticks held back for the next iteration are sent on the same one, and
+ * grids left out of this batch get their turn on it too */
+	bool running = true;
+	bool transfer_blocked = false;
+	bool input_pending = false;
+	while (running){
+		size_t n_contexts;
+		bool grids_waiting;
+		struct tui_context** contexts =
+			process_contexts(&n_contexts, &grids_waiting);
+
+		int timeout = transfer_blocked || input_pending || grids_waiting ? 10 : -1;
+		struct tui_process_res res = arcan_tui_process(contexts,
+			n_contexts, fdset, fdset_sz, timeout);
+
+		if (res.errc != TUI_ERRC_OK){
 			trace("tui_process failed");
 			break;
 		}
 
-		pthread_mutex_unlock(&nvim.synch);
+/* all keys from this wakeup goes out as one request, drags and wheel
+ * ticks are merged the same way */
+		input_pending = flush_input_paced();
 
-		if (res.ok){
-			char cmd;
-			if (read(signalfd, &cmd, 1) == 1){
-				if (cmd == 'q'){
-					trace("quit-requested");
-					break;
-				}
-				else if (cmd == 'l'){
-					pthread_mutex_lock(&nvim.hold);
-					trace("synch");
-					pthread_mutex_unlock(&nvim.hold);
-				}
+/* drain what nvim has sent, though with a cap so the tui contexts still
+ * get processed during a flood */
+		if (nvim.single_thread){
+			enum read_status st = READ_OK;
+			for (size_t i = 0; i < 16 && st == READ_OK; i++)
+				st = read_nvim(signalfd);
+
+			if (st == READ_DEAD || (res.bad & 1)){
+				trace("quit-requested");
+				running = false;
+			}
+		}
+
+/* the wakeup is only a hint, the ring is drained regardless */
+		else {
+			if (res.ok & 1){
+				uint64_t val;
+				read(signalfd, &val, sizeof(val));
+			}
+			atomic_store(&nvim.frame_pending, false);
+
+			if (atomic_load(&nvim.quit)){
+				trace("quit-requested");
+				running = false;
 			}
 		}
+
+		transfer_blocked = export_pump();
+		transfer_blocked |= import_pump();
+		paste_pump();
+
+/* one write for everything the callbacks produced during this iteration */
+		rpc_flush();
+
+/* apply the decoded redraw events, complete frames are written to the tui
+ * contexts as their flush marker is reached */
+		drain_ops();
+
+		if (-1 == arcan_tui_refresh(nvim.tui) && errno == EINVAL)
+			break;
+
+/* a subwindow that has gone bad is left alone, the grid keeps drawing to
+ * its shadow until nvim destroys it */
+		size_t pos = 0;
+		struct nvim_meta* m;
+		while ((m = grids_next(&pos))){
+			if (m->tui && m->tui != nvim.tui)
+				arcan_tui_refresh(m->tui);
+		}
+		latency_refreshed();
+
+		if (res.ok & sig_bit){
+			struct signalfd_siginfo info;
+			while (read(nvim.latency.sigfd, &info, sizeof(info)) == sizeof(info)){}
+			latency_dump(stderr);
+		}
+
+		if (res.ok & metrics_bit)
+			serve_metrics();
 	}
 
-	for (size_t i = 0; i < nvim.n_grids; i++){
-		if (!nvim.grids[i])
-			continue;
+	if (nvim.metrics.path)
+		unlink(nvim.metrics.path);
+
+/* nvim is gone, this lets the callbacks clean up - outside of the lock as
+ * they may take others (e.g. nvim.exports.lock) */
+	pthread_mutex_lock(&nvim.rpc.lock);
+	struct u32map outstanding = nvim.rpc.map;
+	nvim.rpc.map = (struct u32map){.size = outstanding.size};
+	pthread_mutex_unlock(&nvim.rpc.lock);
+	rpc_drop(&outstanding);
+	export_cancel();
+	import_cancel();
+	paste_cancel();
+
+/* subwindows first, the primary is their parent */
+	size_t pos = 0;
+	struct nvim_meta* m;
+	while ((m = grids_next(&pos))){
+		if (m->tui && m->tui != nvim.tui)
+			arcan_tui_destroy(m->tui, NULL);
+		shadow_free(&m->back);
+		shadow_free(&m->screen);
+	}
 
-		arcan_tui_destroy(nvim.grids[i], NULL);
+	arcan_tui_destroy(nvim.tui, NULL);
+	for (pos = 0; (m = grids_next(&pos));)
+		free(m);
+	u32map_free(&nvim.grids);
+
+	trace("cells: received %"PRIu64", written %"PRIu64,
+		nvim.stats.cells_received, nvim.stats.cells_written);
+	trace("keys: %"PRIu64" in %"PRIu64" nvim_input requests",
+		nvim.stats.keys, nvim.stats.key_requests);
+	trace("rpc: %"PRIu64" bytes in %"PRIu64" writes",
+		nvim.stats.bytes_out, nvim.stats.write_calls);
+	trace("mouse: %"PRIu64" drags replaced, %"PRIu64" requests saved",
+		nvim.stats.mouse_dropped, nvim.stats.mouse_requests_saved);
+
+	for (size_t i = 0; i < COUNT_OF(redraw_cmds); i++){
+		if (redraw_hits[i])
+			trace("redraw: %s %"PRIu64, redraw_cmds[i].lbl, redraw_hits[i]);
+	}
+	trace("redraw: unknown %"PRIu64, redraw_hits[REDRAW_UNKNOWN]);
+
+/* for comparing threaded and single-threaded mode on the same workload */
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	trace("%s: %"PRIu64" frames, redraw->apply avg %.1f us, max %.1f us, "
+		"cpu user %ld ms, sys %ld ms",
+		nvim.single_thread ? "single-thread" : "threaded", nvim.stats.frames,
+		nvim.stats.frames ?
+			(double) nvim.stats.frame_ns / nvim.stats.frames / 1000.0 : 0.0,
+		(double) nvim.stats.frame_ns_max / 1000.0,
+		usage.ru_utime.tv_sec * 1000 + usage.ru_utime.tv_usec / 1000,
+		usage.ru_stime.tv_sec * 1000 + usage.ru_stime.tv_usec / 1000);
+
+	if (nvim.latency.flush_refresh.count)
+		latency_dump(stderr);
+
+	if (redraw_profile.summary)
+		redraw_profile_dump(stderr);
+
+/* replay is mainly for benchmarking, so this goes out regardless of tracing */
+	if (nvim.replay.path){
+		double sec = (double)(now_ns() - nvim.replay.start) / 1e9;
+		printf("replay: %"PRIu64" frames in %.3f s, %.1f fps, "
+			"flush avg %.1f us, max %.1f us, peak rss %ld kB\n",
+			nvim.stats.flushes, sec, sec > 0 ? nvim.stats.flushes / sec : 0.0,
+			nvim.stats.flushes ?
+				(double) nvim.stats.flush_ns / nvim.stats.flushes / 1000.0 : 0.0,
+			(double) nvim.stats.flush_ns_max / 1000.0, usage.ru_maxrss);
 	}
 
+	trace_close();
 	return EXIT_SUCCESS;
 }
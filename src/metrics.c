@@ -0,0 +1,70 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include "metrics.h"
+
+#define METRICS_MAX 128
+
+struct metric {
+	const char* name;
+	const char* label_key;
+	const char* label_value;
+	enum metric_kind kind;
+	_Atomic uint64_t* value;
+};
+
+static struct {
+	struct metric entries[METRICS_MAX];
+	size_t count;
+} registry;
+
+bool metric_register(const char* name, const char* label_key,
+	const char* label_value, enum metric_kind kind, _Atomic uint64_t* value)
+{
+	if (registry.count == METRICS_MAX)
+		return false;
+
+	registry.entries[registry.count++] = (struct metric){
+		.name = name,
+		.label_key = label_key,
+		.label_value = label_value,
+		.kind = kind,
+		.value = value
+	};
+
+	return true;
+}
+
+static void write_metric(FILE* out, const struct metric* e)
+{
+	if (e->label_key)
+		fprintf(out, "%s{%s=\"%s\"} %"PRIu64"\n", e->name,
+			e->label_key, e->label_value, metric_get(e->value));
+	else
+		fprintf(out, "%s %"PRIu64"\n", e->name, metric_get(e->value));
+}
+
+void metrics_write(FILE* out)
+{
+/* the format wants all the samples of a name together after its TYPE line,
+ * labelled ones may have been registered at different times */
+	for (size_t i = 0; i < registry.count; i++){
+		const struct metric* e = &registry.entries[i];
+		size_t j = 0;
+		for (; j < i && strcmp(registry.entries[j].name, e->name) != 0; j++){}
+		if (j < i)
+			continue;
+
+		fprintf(out, "# TYPE %s %s\n", e->name,
+			e->kind == METRIC_COUNTER ? "counter" : "gauge");
+
+		for (j = i; j < registry.count; j++){
+			if (strcmp(registry.entries[j].name, e->name) == 0)
+				write_metric(out, &registry.entries[j]);
+		}
+	}
+}
@@ -0,0 +1,50 @@
+/*
+ * Metrics registry
+ *
+ * A flat list of named counters and gauges, each pointing to a value that
+ * lives with the code that updates it. The list is written out in the
+ * Prometheus text format (see metrics_write), which is what is served on
+ * the NVIM_ARCAN_METRICS socket.
+ *
+ * Registration and writing should happen on one thread. The values may be
+ * updated from any thread, but each should only have one writer - that way
+ * metric_add is a plain load and store instead of a locked add, and a reader
+ * sees a value that is at most slightly behind. Values with more than one
+ * writer use atomic_fetch_add / atomic_fetch_sub directly.
+ */
+#ifndef NVIM_ARCAN_METRICS_H
+#define NVIM_ARCAN_METRICS_H
+
+enum metric_kind {
+	METRIC_COUNTER = 0,
+	METRIC_GAUGE = 1
+};
+
+/*
+ * [name] and the optional [label_key] / [label_value] are not copied, several
+ * metrics with the same name and different labels form one family. Returns
+ * false if the registry is full.
+ */
+bool metric_register(const char* name, const char* label_key,
+	const char* label_value, enum metric_kind kind, _Atomic uint64_t* value);
+
+void metrics_write(FILE* out);
+
+static inline void metric_add(_Atomic uint64_t* value, uint64_t n)
+{
+	atomic_store_explicit(value,
+		atomic_load_explicit(value, memory_order_relaxed) + n,
+		memory_order_relaxed);
+}
+
+static inline void metric_set(_Atomic uint64_t* value, uint64_t n)
+{
+	atomic_store_explicit(value, n, memory_order_relaxed);
+}
+
+static inline uint64_t metric_get(_Atomic uint64_t* value)
+{
+	return atomic_load_explicit(value, memory_order_relaxed);
+}
+
+#endif
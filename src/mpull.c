@@ -0,0 +1,246 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "mpull.h"
+
+static uint64_t load_be(const uint8_t* p, size_t n)
+{
+	uint64_t val = 0;
+	for (size_t i = 0; i < n; i++)
+		val = (val << 8) | p[i];
+	return val;
+}
+
+/* [n] bytes of big endian length/value following the type byte, false if
+ * the buffer ends before that */
+static bool load_arg(const struct mpull* c, size_t n, uint64_t* val)
+{
+	if ((size_t)(c->end - c->pos) < 1 + n)
+		return false;
+
+	*val = load_be(&c->pos[1], n);
+	return true;
+}
+
+static bool container(struct mpull* c, uint32_t* n, bool map)
+{
+	if (c->pos >= c->end)
+		return false;
+
+	uint8_t b = c->pos[0];
+	uint8_t fix = map ? 0x80 : 0x90;
+	uint8_t ext = map ? 0xde : 0xdc;
+	uint64_t val;
+
+	if ((b & 0xf0) == fix){
+		*n = b & 0x0f;
+		c->pos++;
+		return true;
+	}
+
+	size_t sz = b == ext ? 2 : b == ext + 1 ? 4 : 0;
+	if (!sz || !load_arg(c, sz, &val))
+		return false;
+
+	*n = val;
+	c->pos += 1 + sz;
+	return true;
+}
+
+bool mpull_array(struct mpull* c, uint32_t* n)
+{
+	return container(c, n, false);
+}
+
+bool mpull_map(struct mpull* c, uint32_t* n)
+{
+	return container(c, n, true);
+}
+
+bool mpull_str(struct mpull* c, const char** ptr, uint32_t* len)
+{
+	if (c->pos >= c->end)
+		return false;
+
+	uint8_t b = c->pos[0];
+	size_t hdr = 1;
+	uint64_t val;
+
+	if ((b & 0xe0) == 0xa0)
+		val = b & 0x1f;
+	else if (b >= 0xd9 && b <= 0xdb){
+		hdr = (size_t) 1 << (b - 0xd9);
+		if (!load_arg(c, hdr, &val))
+			return false;
+		hdr++;
+	}
+	else
+		return false;
+
+	if ((uint64_t)(c->end - c->pos) - hdr < val)
+		return false;
+
+	*ptr = (const char*) &c->pos[hdr];
+	*len = val;
+	c->pos += hdr + val;
+	return true;
+}
+
+/* decode any integer, [neg] is set if it is an int type with its sign bit */
+static bool integer(struct mpull* c, uint64_t* val, bool* neg)
+{
+	if (c->pos >= c->end)
+		return false;
+
+	uint8_t b = c->pos[0];
+	*neg = false;
+
+	if (b <= 0x7f){
+		*val = b;
+		c->pos++;
+		return true;
+	}
+
+	if (b >= 0xe0){
+		*val = (uint64_t)(int64_t)(int8_t) b;
+		*neg = true;
+		c->pos++;
+		return true;
+	}
+
+/* uint8..uint64 (0xcc..0xcf), int8..int64 (0xd0..0xd3) */
+	if (b < 0xcc || b > 0xd3)
+		return false;
+
+	size_t sz = (size_t) 1 << ((b - 0xcc) % 4);
+	if (!load_arg(c, sz, val))
+		return false;
+
+	if (b >= 0xd0 && sz < 8 && (*val >> (sz * 8 - 1))){
+		*val |= ~(uint64_t) 0 << (sz * 8);
+		*neg = true;
+	}
+	else if (b >= 0xd0 && sz == 8)
+		*neg = *val >> 63;
+
+	c->pos += 1 + sz;
+	return true;
+}
+
+bool mpull_uint(struct mpull* c, uint64_t* val)
+{
+	struct mpull save = *c;
+	bool neg;
+
+	if (!integer(c, val, &neg))
+		return false;
+
+	if (neg){
+		*c = save;
+		return false;
+	}
+
+	return true;
+}
+
+bool mpull_int(struct mpull* c, int64_t* val)
+{
+	struct mpull save = *c;
+	uint64_t uval;
+	bool neg;
+
+	if (!integer(c, &uval, &neg))
+		return false;
+
+	if (!neg && uval > INT64_MAX){
+		*c = save;
+		return false;
+	}
+
+	*val = (int64_t) uval;
+	return true;
+}
+
+enum mpull_status mpull_skip(struct mpull* c)
+{
+	const uint8_t* pos = c->pos;
+	uint64_t left = 1;
+
+/* iterative, [left] is the number of values still to skip at any depth */
+	while (left){
+		if (pos >= c->end)
+			return MPULL_SHORT;
+
+		uint8_t b = *pos;
+		size_t avail = c->end - pos;
+		size_t hdr = 1;
+		uint64_t body = 0;
+		left--;
+
+		if (b <= 0x7f || b >= 0xe0 || (b >= 0xc0 && b <= 0xc3 && b != 0xc1)){
+		}
+		else if (b <= 0x8f)
+			left += 2 * (uint64_t)(b & 0x0f);
+		else if (b <= 0x9f)
+			left += b & 0x0f;
+		else if (b <= 0xbf)
+			body = b & 0x1f;
+		else if (b == 0xc1)
+			return MPULL_BAD;
+		else {
+			size_t sz = 0;
+
+			switch (b){
+/* bin8..32, ext8..32 (ext has a type byte after the length) */
+			case 0xc4: case 0xc5: case 0xc6:
+				sz = (size_t) 1 << (b - 0xc4);
+			break;
+			case 0xc7: case 0xc8: case 0xc9:
+				sz = (size_t) 1 << (b - 0xc7);
+			break;
+/* float32, float64 */
+			case 0xca: body = 4; break;
+			case 0xcb: body = 8; break;
+/* uint / int */
+			case 0xcc: case 0xd0: body = 1; break;
+			case 0xcd: case 0xd1: body = 2; break;
+			case 0xce: case 0xd2: body = 4; break;
+			case 0xcf: case 0xd3: body = 8; break;
+/* fixext 1..16, type byte + data */
+			case 0xd4: body = 2; break;
+			case 0xd5: body = 3; break;
+			case 0xd6: body = 5; break;
+			case 0xd7: body = 9; break;
+			case 0xd8: body = 17; break;
+/* str8..32 */
+			case 0xd9: case 0xda: case 0xdb:
+				sz = (size_t) 1 << (b - 0xd9);
+			break;
+/* array16/32, map16/32 */
+			case 0xdc: case 0xdd: case 0xde: case 0xdf:
+				sz = b % 2 ? 4 : 2;
+			break;
+			}
+
+			if (sz){
+				if (avail < 1 + sz)
+					return MPULL_SHORT;
+				uint64_t val = load_be(&pos[1], sz);
+				hdr += sz;
+
+				if (b >= 0xdc)
+					left += b >= 0xde ? 2 * val : val;
+				else
+					body = val + (b >= 0xc7 && b <= 0xc9);
+			}
+		}
+
+		if (avail < hdr || avail - hdr < body)
+			return MPULL_SHORT;
+
+		pos += hdr + body;
+	}
+
+	c->pos = pos;
+	return MPULL_OK;
+}
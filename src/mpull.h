@@ -0,0 +1,42 @@
+/*
+ * Pull decoder for msgpack
+ *
+ * Reads values in place from a byte range, without building an object tree,
+ * for the hot paths where the expected structure is known up front (mainly
+ * grid_line batches). The reading functions leave the cursor untouched if
+ * the next value is not of the requested type or is incomplete.
+ *
+ * mpull_skip is used for framing: it advances past one complete value, and
+ * tells "need more data" apart from malformed input.
+ */
+#ifndef NVIM_ARCAN_MPULL_H
+#define NVIM_ARCAN_MPULL_H
+
+struct mpull {
+	const uint8_t* pos;
+	const uint8_t* end;
+};
+
+enum mpull_status {
+	MPULL_OK = 0,
+	MPULL_SHORT = 1,
+	MPULL_BAD = 2
+};
+
+/* array / map header, [n] is the number of elements (pairs for maps) */
+bool mpull_array(struct mpull* c, uint32_t* n);
+bool mpull_map(struct mpull* c, uint32_t* n);
+
+/* str (not bin), [ptr] refers into the decoded buffer */
+bool mpull_str(struct mpull* c, const char** ptr, uint32_t* len);
+
+/* any integer encoding with a non-negative value */
+bool mpull_uint(struct mpull* c, uint64_t* val);
+
+/* any integer encoding that fits in an int64_t */
+bool mpull_int(struct mpull* c, int64_t* val);
+
+/* advance past one complete value, including any nested values */
+enum mpull_status mpull_skip(struct mpull* c);
+
+#endif
@@ -0,0 +1,234 @@
+#include <arcan_shmif.h>
+#include <arcan_tui.h>
+#include "shadow.h"
+
+static void fill_cells(struct shadow_cell* dst,
+	size_t n, const struct tui_screen_attr* attr)
+{
+	for (size_t i = 0; i < n; i++){
+		dst[i] = (struct shadow_cell){
+			.ch = ' ',
+			.attr = *attr
+		};
+	}
+}
+
+static size_t bitmap_words(size_t rows)
+{
+	return (rows + 63) / 64;
+}
+
+bool shadow_resize(struct shadow_grid* g,
+	size_t cols, size_t rows, const struct tui_screen_attr* attr)
+{
+	if (cols == g->cols && rows == g->rows){
+		shadow_mark_all(g);
+		return true;
+	}
+
+	struct shadow_cell* cells = NULL;
+	struct shadow_cell** rowptr = NULL;
+	struct shadow_cell** scratch = NULL;
+	uint64_t* dirty = NULL;
+	struct shadow_span* span = NULL;
+
+	if (cols && rows){
+		cells = malloc(sizeof(struct shadow_cell) * cols * rows);
+		rowptr = malloc(sizeof(struct shadow_cell*) * rows);
+		scratch = malloc(sizeof(struct shadow_cell*) * rows);
+		dirty = malloc(sizeof(uint64_t) * bitmap_words(rows));
+		span = malloc(sizeof(struct shadow_span) * rows);
+		if (!cells || !rowptr || !scratch || !dirty || !span){
+			free(cells);
+			free(rowptr);
+			free(scratch);
+			free(dirty);
+			free(span);
+			return false;
+		}
+	}
+
+/* keep the overlapping region, blank the rest */
+	for (size_t row = 0; row < rows; row++){
+		struct shadow_cell* dst = &cells[row * cols];
+		rowptr[row] = dst;
+		size_t keep = 0;
+
+		if (row < g->rows){
+			keep = cols < g->cols ? cols : g->cols;
+			memcpy(dst, shadow_row(g, row), keep * sizeof(struct shadow_cell));
+		}
+
+		fill_cells(&dst[keep], cols - keep, attr);
+	}
+
+	free(g->cells);
+	free(g->row);
+	free(g->scratch);
+	free(g->dirty);
+	free(g->span);
+	g->cells = cells;
+	g->row = rowptr;
+	g->scratch = scratch;
+	g->dirty = dirty;
+	g->span = span;
+	g->cols = cols;
+	g->rows = rows;
+
+	if (g->cx >= cols)
+		g->cx = cols ? cols - 1 : 0;
+	if (g->cy >= rows)
+		g->cy = rows ? rows - 1 : 0;
+
+	shadow_mark_all(g);
+	return true;
+}
+
+void shadow_free(struct shadow_grid* g)
+{
+	free(g->cells);
+	free(g->row);
+	free(g->scratch);
+	free(g->dirty);
+	free(g->span);
+	*g = (struct shadow_grid){0};
+}
+
+void shadow_mark(struct shadow_grid* g, size_t row, size_t lo, size_t hi)
+{
+	if (hi <= lo)
+		return;
+
+	struct shadow_span* span = &g->span[row];
+	g->dirty[row / 64] |= (uint64_t) 1 << (row % 64);
+
+	if (span->lo >= span->hi){
+		*span = (struct shadow_span){.lo = lo, .hi = hi};
+		return;
+	}
+
+	if (lo < span->lo)
+		span->lo = lo;
+	if (hi > span->hi)
+		span->hi = hi;
+}
+
+void shadow_mark_all(struct shadow_grid* g)
+{
+	if (!g->rows)
+		return;
+
+	size_t words = bitmap_words(g->rows);
+	memset(g->dirty, 0xff, sizeof(uint64_t) * words);
+
+/* don't let the tail of the last word refer to rows that don't exist */
+	if (g->rows % 64)
+		g->dirty[words - 1] = ((uint64_t) 1 << (g->rows % 64)) - 1;
+
+	for (size_t row = 0; row < g->rows; row++)
+		g->span[row] = (struct shadow_span){.lo = 0, .hi = g->cols};
+}
+
+void shadow_clean(struct shadow_grid* g)
+{
+	if (!g->rows)
+		return;
+
+	memset(g->dirty, 0, sizeof(uint64_t) * bitmap_words(g->rows));
+	memset(g->span, 0, sizeof(struct shadow_span) * g->rows);
+}
+
+size_t shadow_write(struct shadow_grid* g, size_t col, size_t row,
+	uint32_t ch, const struct tui_screen_attr* attr, size_t count)
+{
+	if (row >= g->rows || col >= g->cols)
+		return col + count;
+
+	size_t end = col + count;
+	if (end > g->cols)
+		end = g->cols;
+
+	struct shadow_cell* dst = shadow_row(g, row);
+	for (size_t i = col; i < end; i++){
+		dst[i].ch = ch;
+		dst[i].attr = *attr;
+	}
+
+	shadow_mark(g, row, col, end);
+	return col + count;
+}
+
+void shadow_clear(struct shadow_grid* g, const struct tui_screen_attr* attr)
+{
+	fill_cells(g->cells, g->cols * g->rows, attr);
+	shadow_mark_all(g);
+}
+
+/* rotate the row pointers [top, top + height) [step] entries up or down */
+static void rotate_rows(struct shadow_grid* g,
+	size_t top, size_t height, size_t step, bool up)
+{
+	struct shadow_cell** b = &g->row[top];
+	size_t keep = (height - step) * sizeof(struct shadow_cell*);
+	size_t n = step * sizeof(struct shadow_cell*);
+
+	if (up){
+		memcpy(g->scratch, b, n);
+		memmove(b, &b[step], keep);
+		memcpy(&b[height - step], g->scratch, n);
+	}
+	else {
+		memcpy(g->scratch, &b[height - step], n);
+		memmove(&b[step], b, keep);
+		memcpy(b, g->scratch, n);
+	}
+}
+
+void shadow_scroll(struct shadow_grid* g,
+	size_t top, size_t bottom, size_t left, size_t right, ssize_t rows)
+{
+	if (bottom > g->rows)
+		bottom = g->rows;
+	if (right > g->cols)
+		right = g->cols;
+	if (top >= bottom || left >= right || rows == 0)
+		return;
+
+	size_t step = rows > 0 ? rows : -rows;
+	size_t height = bottom - top;
+
+/* everything in the region is exposed */
+	if (step >= height){
+		for (size_t row = top; row < bottom; row++)
+			shadow_mark(g, row, left, right);
+		return;
+	}
+
+/* full width, rotate the row pointers and recycle the rows that scroll out
+ * of the region as the exposed ones - otherwise (vertical splits) the cells
+ * need to move */
+	if (left == 0 && right == g->cols){
+		rotate_rows(g, top, height, step, rows > 0);
+	}
+	else {
+		size_t n = (right - left) * sizeof(struct shadow_cell);
+
+/* scroll up, copy from top to bottom so the source is not overwritten */
+		if (rows > 0){
+			for (size_t row = top; row + rows < bottom; row++){
+				memcpy(&shadow_row(g, row)[left],
+					&shadow_row(g, row + rows)[left], n);
+			}
+		}
+		else {
+			for (ssize_t row = bottom - 1; row + rows >= (ssize_t) top; row--){
+				memcpy(&shadow_row(g, row)[left],
+					&shadow_row(g, row + rows)[left], n);
+			}
+		}
+	}
+
+/* whatever has been written out from the region no longer matches */
+	for (size_t row = top; row < bottom; row++)
+		shadow_mark(g, row, left, right);
+}
@@ -0,0 +1,103 @@
+/*
+ * Shadow cell grid
+ *
+ * Keeps a copy of the cell contents of a nvim grid outside of the tui
+ * context, the render thread applies the decoded redraw events to it and on
+ * flush writes out the difference against a mirror of the tui context.
+ *
+ * Every modification is tracked in a per-row dirty bitmap along with the
+ * [lo, hi) column span that was touched, so that applying only needs to
+ * consider what has actually been redrawn.
+ *
+ * Cells are accessed through a table of row pointers, scrolling the full
+ * width of the grid only moves the pointers around and the rows that scroll
+ * out of the region are recycled as the exposed ones.
+ */
+#ifndef NVIM_ARCAN_SHADOW_H
+#define NVIM_ARCAN_SHADOW_H
+
+struct shadow_cell {
+	uint32_t ch;
+	struct tui_screen_attr attr;
+};
+
+struct shadow_span {
+	size_t lo, hi;
+};
+
+struct shadow_grid {
+	size_t cols, rows;
+	struct shadow_cell* cells;
+
+/* row order into [cells], [scratch] is used when rotating row ranges */
+	struct shadow_cell** row;
+	struct shadow_cell** scratch;
+
+/* one bit per row, with the touched column range in span[row] */
+	uint64_t* dirty;
+	struct shadow_span* span;
+
+/* last known cursor position in grid cells */
+	size_t cx, cy;
+};
+
+/*
+ * (re-)allocate [g] to fit [cols * rows], contents are preserved in the
+ * overlapping region and the rest is filled with blank cells using [attr],
+ * all rows are marked as dirty
+ */
+bool shadow_resize(struct shadow_grid* g,
+	size_t cols, size_t rows, const struct tui_screen_attr* attr);
+
+void shadow_free(struct shadow_grid* g);
+
+/*
+ * write [count] repetitions of [ch] starting at [col, row], clipped to the
+ * grid dimensions, returns the column following the run (even if clipped)
+ */
+size_t shadow_write(struct shadow_grid* g, size_t col, size_t row,
+	uint32_t ch, const struct tui_screen_attr* attr, size_t count);
+
+/* fill the entire grid with blank cells using [attr] */
+void shadow_clear(struct shadow_grid* g, const struct tui_screen_attr* attr);
+
+/*
+ * move the region [top, bottom) x [left, right) [rows] rows up (positive) or
+ * down (negative), the contents of the rows that are exposed is undefined and
+ * expected to be redrawn by the caller (this matches nvim grid_scroll). The
+ * region is marked as dirty.
+ */
+void shadow_scroll(struct shadow_grid* g,
+	size_t top, size_t bottom, size_t left, size_t right, ssize_t rows);
+
+/* extend the dirty span of [row] to cover [lo, hi) */
+void shadow_mark(struct shadow_grid* g, size_t row, size_t lo, size_t hi);
+
+/* mark every row as dirty over the full width */
+void shadow_mark_all(struct shadow_grid* g);
+
+/* reset the dirty state of every row */
+void shadow_clean(struct shadow_grid* g);
+
+static inline struct shadow_cell* shadow_row(
+	const struct shadow_grid* g, size_t row)
+{
+	return g->row[row];
+}
+
+static inline bool shadow_row_dirty(const struct shadow_grid* g, size_t row)
+{
+	return (g->dirty[row / 64] >> (row % 64)) & 1;
+}
+
+/* compares only the fields we set, the attribute structure may have padding */
+static inline bool shadow_cell_equal(
+	const struct shadow_cell* a, const struct shadow_cell* b)
+{
+	return a->ch == b->ch &&
+		a->attr.aflags == b->attr.aflags &&
+		memcmp(a->attr.fc, b->attr.fc, 3) == 0 &&
+		memcmp(a->attr.bc, b->attr.bc, 3) == 0;
+}
+
+#endif
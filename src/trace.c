@@ -0,0 +1,219 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include "trace.h"
+
+/* 64 byte records, 4 MiB */
+#define TRACE_RING_SIZE 65536
+
+_Atomic bool trace_enabled;
+
+_Static_assert(sizeof(struct trace_record) == 64, "trace record size");
+
+/*
+ * bounded multi-producer queue: each slot has a sequence number which says
+ * whether it is free for the producer that claims position [seq] (== seq) or
+ * holds a record for the consumer at position [seq - 1] (== seq + 1)
+ */
+struct trace_slot {
+	_Atomic size_t seq;
+	struct trace_record rec;
+};
+
+static struct {
+	struct trace_slot* slots;
+	_Alignas(64) _Atomic size_t head;
+	_Alignas(64) size_t tail;
+	_Atomic uint64_t dropped;
+	_Atomic uint16_t threads;
+	_Atomic bool running;
+	FILE* out;
+	pthread_t writer;
+} ring;
+
+static _Thread_local uint16_t thread_id;
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void push(const struct trace_record* rec)
+{
+	size_t pos = atomic_load_explicit(&ring.head, memory_order_relaxed);
+	struct trace_slot* slot;
+
+	for (;;){
+		slot = &ring.slots[pos % TRACE_RING_SIZE];
+		size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+
+		if (diff == 0){
+			if (atomic_compare_exchange_weak_explicit(&ring.head, &pos, pos + 1,
+				memory_order_relaxed, memory_order_relaxed))
+				break;
+		}
+/* the writer hasn't caught up with this slot yet, full */
+		else if (diff < 0){
+			atomic_fetch_add_explicit(&ring.dropped, 1, memory_order_relaxed);
+			return;
+		}
+		else
+			pos = atomic_load_explicit(&ring.head, memory_order_relaxed);
+	}
+
+	slot->rec = *rec;
+	atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+}
+
+static uint16_t current_thread()
+{
+	if (!thread_id)
+		thread_id = atomic_fetch_add(&ring.threads, 1) + 1;
+	return thread_id;
+}
+
+void trace_record(enum trace_event event,
+	uint32_t grid, uint64_t size, const uint64_t arg[5])
+{
+	struct trace_record rec = {
+		.ns = now_ns(),
+		.event = event,
+		.thread = current_thread(),
+		.grid = grid,
+		.size = size
+	};
+	memcpy(rec.arg, arg, sizeof(rec.arg));
+	push(&rec);
+}
+
+void trace_text(const char* fmt, ...)
+{
+	char buf[256];
+	va_list args;
+	va_start(args, fmt);
+	int len = vsnprintf(buf, sizeof(buf), fmt, args);
+	va_end(args);
+
+	if (len < 0)
+		return;
+	if ((size_t) len >= sizeof(buf))
+		len = sizeof(buf) - 1;
+
+	struct trace_record rec = {
+		.ns = now_ns(),
+		.event = TRACE_TEXT,
+		.thread = current_thread(),
+		.size = len
+	};
+
+	for (size_t ofs = 0; ofs == 0 || ofs < (size_t) len; ofs += TRACE_TEXT_LEN){
+		size_t n = (size_t) len - ofs < TRACE_TEXT_LEN ? len - ofs : TRACE_TEXT_LEN;
+		memset(rec.text, '\0', TRACE_TEXT_LEN);
+		memcpy(rec.text, &buf[ofs], n);
+		push(&rec);
+		rec.event = TRACE_TEXT_MORE;
+	}
+}
+
+/* move everything that is ready to the output, false if there was nothing */
+static bool drain()
+{
+	struct trace_record batch[256];
+	size_t n = 0;
+
+	for (; n < 256; n++){
+		struct trace_slot* slot = &ring.slots[ring.tail % TRACE_RING_SIZE];
+		size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		if (seq != ring.tail + 1)
+			break;
+
+		batch[n] = slot->rec;
+		atomic_store_explicit(&slot->seq,
+			ring.tail + TRACE_RING_SIZE, memory_order_release);
+		ring.tail++;
+	}
+
+	if (n)
+		fwrite(batch, sizeof(struct trace_record), n, ring.out);
+
+	return n > 0;
+}
+
+static void* thread_writer(void* data)
+{
+	while (atomic_load(&ring.running)){
+		if (!drain()){
+			fflush(ring.out);
+			nanosleep(&(struct timespec){.tv_nsec = 5000000}, NULL);
+		}
+	}
+
+	while (drain()){}
+	return NULL;
+}
+
+bool trace_open(const char* path)
+{
+	ring.out = strcmp(path, "-") == 0 ? stderr : fopen(path, "w");
+	if (!ring.out)
+		return false;
+
+	ring.slots = malloc(sizeof(struct trace_slot) * TRACE_RING_SIZE);
+	if (!ring.slots)
+		goto fail;
+
+	for (size_t i = 0; i < TRACE_RING_SIZE; i++)
+		atomic_init(&ring.slots[i].seq, i);
+
+	fwrite(TRACE_MAGIC, 8, 1, ring.out);
+	atomic_store(&ring.running, true);
+
+	if (0 != pthread_create(&ring.writer, NULL, thread_writer, NULL)){
+		free(ring.slots);
+		goto fail;
+	}
+
+	trace_enabled = true;
+	return true;
+
+fail:
+	if (ring.out != stderr)
+		fclose(ring.out);
+	ring.out = NULL;
+	return false;
+}
+
+void trace_close()
+{
+	if (!trace_enabled)
+		return;
+
+/* anything traced after this point (other threads still running) is lost */
+	atomic_store(&ring.running, false);
+	pthread_join(ring.writer, NULL);
+	trace_enabled = false;
+
+	struct trace_record rec = {
+		.ns = now_ns(),
+		.event = TRACE_DROPPED,
+		.thread = current_thread(),
+		.size = atomic_load(&ring.dropped)
+	};
+	fwrite(&rec, sizeof(rec), 1, ring.out);
+
+	if (ring.out != stderr)
+		fclose(ring.out);
+	else
+		fflush(ring.out);
+	ring.out = NULL;
+}
@@ -0,0 +1,115 @@
+/*
+ * Binary trace
+ *
+ * Trace points write fixed size records into a lock-free ring (any number of
+ * producer threads), a writer thread drains it to the NVIM_ARCAN_TRACE file.
+ * A producer never blocks or allocates: when the ring is full the record is
+ * dropped and counted, the count is written as the last record.
+ *
+ * trace_ev records a structured event, trace() formats a free-form message
+ * into one or more TRACE_TEXT records and is meant for the unusual paths.
+ * Both are removed at compile time if NVIM_ARCAN_NO_TRACE is defined (the
+ * 'trace' build option), the arguments are then never evaluated.
+ *
+ * File format, host byte order: TRACE_MAGIC (8 bytes), then records. Use
+ * tools/trace-decode.c to turn it back into text.
+ */
+#ifndef NVIM_ARCAN_TRACE_H
+#define NVIM_ARCAN_TRACE_H
+
+#define TRACE_MAGIC "NVARTRC1"
+#define TRACE_TEXT_LEN 40
+
+enum trace_event {
+/* free-form message, continued by TRACE_TEXT_MORE records from the same thread */
+	TRACE_TEXT = 0,
+	TRACE_TEXT_MORE,
+
+/* size: bytes read from nvim, arg[0]: bytes buffered */
+	TRACE_READ,
+
+/* size: message array size, arg[0]: type, arg[1]: msgid / method */
+	TRACE_MESSAGE,
+
+/* size: number of events in a redraw batch */
+	TRACE_REDRAW,
+
+/* arg[0]: redraw command (enum redraw_cmd in main.c), size: arguments */
+	TRACE_REDRAW_EVENT,
+
+/* grid, size: cells, arg[0]: row, arg[1]: col */
+	TRACE_GRID_LINE,
+
+/* input side flush, arg[0]: ns since the first redraw of the frame */
+	TRACE_FLUSH,
+
+/* render side, size: cells written, arg[0]: ns spent applying the frame */
+	TRACE_FRAME,
+
+/* size: bytes, arg[0]: keysym (0 for utf8), arg[1]: modifiers */
+	TRACE_KEY,
+
+/* size: keys, arg[0]: bytes in the nvim_input request */
+	TRACE_INPUT,
+
+/* size: bytes written to nvim, arg[0]: write calls */
+	TRACE_RPC_WRITE,
+
+/* grid, arg[0]: cols, arg[1]: rows */
+	TRACE_RESIZE,
+
+/* size: records dropped because the ring was full */
+	TRACE_DROPPED,
+
+/* one per redraw command used in a frame and side, written at its flush
+ * when profiling (NVIM_ARCAN_PROFILE): size: calls (operations when
+ * applying), arg[0]: redraw command, arg[1]: ns total, arg[2]: ns max,
+ * arg[3]: arguments, arg[4]: 0 decoding (input thread), 1 applying (render
+ * thread) */
+	TRACE_REDRAW_COST,
+
+	TRACE_EVENT_COUNT
+};
+
+struct trace_record {
+	uint64_t ns;
+	uint16_t event;
+
+/* small per-thread number, in the order threads first traced */
+	uint16_t thread;
+	uint32_t grid;
+	uint64_t size;
+	union {
+		uint64_t arg[5];
+		char text[TRACE_TEXT_LEN];
+	};
+};
+
+#ifdef NVIM_ARCAN_NO_TRACE
+/* still type-checked (format strings too), but never evaluated */
+#define trace(...) do { if (0) trace_text(__VA_ARGS__); } while (0)
+#define trace_ev(ev, grid, size, ...) do { if (0)\
+	trace_record(ev, grid, size, (const uint64_t[5]){__VA_ARGS__}); } while (0)
+#else
+#define trace(...) do { if (trace_enabled) trace_text(__VA_ARGS__); } while (0)
+#define trace_ev(ev, grid, size, ...) do { if (trace_enabled)\
+	trace_record(ev, grid, size, (const uint64_t[5]){__VA_ARGS__}); } while (0)
+#endif
+
+/* set by trace_open, before any other thread exists */
+extern _Atomic bool trace_enabled;
+
+/* start the writer thread on [path] ("-" for stderr) */
+bool trace_open(const char* path);
+
+/* stop the writer thread once everything queued is written */
+void trace_close();
+
+/* use trace_ev, which takes the arguments as a list (up to 5) */
+void trace_record(enum trace_event event,
+	uint32_t grid, uint64_t size, const uint64_t arg[5]);
+
+void trace_text(const char* fmt, ...)
+	__attribute__((format(printf, 1, 2)));
+
+#endif
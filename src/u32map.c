@@ -0,0 +1,133 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "u32map.h"
+
+#define U32MAP_INITIAL 16
+
+/* keys come in sequence, a multiplicative hash spreads runs of them over the
+ * table instead of having them end up next to each other */
+static size_t slot_for(const struct u32map* map, uint32_t key)
+{
+	return (size_t)((key * 2654435761u) & (map->cap - 1));
+}
+
+static void* value_at(const struct u32map* map, size_t i)
+{
+	return &map->values[i * map->size];
+}
+
+static bool put(struct u32map* map, uint32_t key, const void* value)
+{
+	size_t i = slot_for(map, key);
+	for (; map->used[i]; i = (i + 1) & (map->cap - 1)){
+		if (map->keys[i] == key)
+			return false;
+	}
+
+	map->keys[i] = key;
+	memcpy(value_at(map, i), value, map->size);
+	map->used[i] = true;
+	map->count++;
+	return true;
+}
+
+/* one allocation for all three arrays, [values] first as it has the widest
+ * alignment - with [cap] a power of two the [keys] after it line up too */
+static bool grow(struct u32map* map)
+{
+	size_t cap = map->cap ? map->cap * 2 : U32MAP_INITIAL;
+	struct u32map old = *map;
+
+	uint8_t* block = calloc(cap, map->size + sizeof(uint32_t) + sizeof(bool));
+	if (!block)
+		return false;
+
+	map->values = block;
+	map->keys = (uint32_t*) &block[cap * map->size];
+	map->used = (bool*) &map->keys[cap];
+	map->cap = cap;
+	map->count = 0;
+
+	for (size_t i = 0; i < old.cap; i++){
+		if (old.used[i])
+			put(map, old.keys[i], value_at(&old, i));
+	}
+
+	free(old.values);
+	return true;
+}
+
+bool u32map_insert(struct u32map* map, uint32_t key, const void* value)
+{
+	if ((map->count + 1) * 2 > map->cap && !grow(map))
+		return false;
+
+	return put(map, key, value);
+}
+
+static bool find(const struct u32map* map, uint32_t key, size_t* pos)
+{
+	if (!map->count)
+		return false;
+
+	size_t i = slot_for(map, key);
+	for (; map->used[i] && map->keys[i] != key; i = (i + 1) & (map->cap - 1)){}
+
+	*pos = i;
+	return map->used[i];
+}
+
+void* u32map_get(const struct u32map* map, uint32_t key)
+{
+	size_t i;
+	return find(map, key, &i) ? value_at(map, i) : NULL;
+}
+
+bool u32map_take(struct u32map* map, uint32_t key, void* out)
+{
+	size_t i;
+	if (!find(map, key, &i))
+		return false;
+
+	if (out)
+		memcpy(out, value_at(map, i), map->size);
+
+	size_t mask = map->cap - 1;
+	map->used[i] = false;
+	map->count--;
+
+/* move back any entry after the hole that would no longer be reachable from
+ * its home slot, until the end of the run */
+	for (size_t j = (i + 1) & mask; map->used[j]; j = (j + 1) & mask){
+		size_t home = slot_for(map, map->keys[j]);
+		if (((j - home) & mask) < ((j - i) & mask))
+			continue;
+
+		map->keys[i] = map->keys[j];
+		memcpy(value_at(map, i), value_at(map, j), map->size);
+		map->used[i] = true;
+		map->used[j] = false;
+		i = j;
+	}
+
+	return true;
+}
+
+void* u32map_next(const struct u32map* map, size_t* pos)
+{
+	for (; *pos < map->cap; (*pos)++){
+		if (map->used[*pos])
+			return value_at(map, (*pos)++);
+	}
+
+	return NULL;
+}
+
+void u32map_free(struct u32map* map)
+{
+	free(map->values);
+	*map = (struct u32map){.size = map->size};
+}
@@ -0,0 +1,51 @@
+/*
+ * uint32_t keyed table
+ *
+ * Used for the requests sent to nvim that haven't been answered yet (by
+ * msgid) and for the grid registry (by grid id). Both kinds of keys are
+ * handed out in sequence and never reused, so they get sparse over a long
+ * session and are hashed rather than used as an index.
+ *
+ * Open addressing with linear probing in a power of two table that doubles
+ * when it is half full, removal shifts the following entries back so there
+ * are no tombstones - lookups stay short no matter how many entries have
+ * come and gone. The values are [size] bytes each and stored in the table,
+ * so an insert doesn't allocate unless the table grows - which also means
+ * they move, pointers into the table are only good until the next insert or
+ * take.
+ *
+ * Not thread safe, the caller has to serialise access.
+ */
+#ifndef NVIM_ARCAN_U32MAP_H
+#define NVIM_ARCAN_U32MAP_H
+
+struct u32map {
+/* set before first use, e.g. {.size = sizeof(struct x)}, kept by free */
+	size_t size;
+
+	uint32_t* keys;
+	uint8_t* values;
+	bool* used;
+	size_t cap;
+	size_t count;
+};
+
+/* copy [value] in under [key], false if the table couldn't grow or [key] is
+ * already there */
+bool u32map_insert(struct u32map* map, uint32_t key, const void* value);
+
+/* the value for [key] in the table, NULL if there is none */
+void* u32map_get(const struct u32map* map, uint32_t key);
+
+/* remove the entry for [key] and copy its value to [out] (if set), false if
+ * there is none */
+bool u32map_take(struct u32map* map, uint32_t key, void* out);
+
+/* iterate, start with [pos] at 0 and stop at NULL - the map must not be
+ * modified in between */
+void* u32map_next(const struct u32map* map, size_t* pos);
+
+/* what the values refer to is left to the caller */
+void u32map_free(struct u32map* map);
+
+#endif
@@ -0,0 +1,192 @@
+/*
+ * trace decoder
+ *
+ * Turns a NVIM_ARCAN_TRACE file (see src/trace.h) back into text, one line
+ * per event:
+ *
+ *  <ms since the first record> <thread> <event> <fields>
+ *
+ * Records are in the order they were pushed to the ring rather than strictly
+ * in time, the clock is read before the push, so a record can be slightly
+ * older than the first one and get a negative time.
+ *
+ * Free-form messages that were split over several records are joined again.
+ *
+ * trace-decode [file], reads stdin if no file is given.
+ */
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+
+static const char* event_names[TRACE_EVENT_COUNT] = {
+	[TRACE_TEXT] = "text",
+	[TRACE_TEXT_MORE] = "text",
+	[TRACE_READ] = "read",
+	[TRACE_MESSAGE] = "message",
+	[TRACE_REDRAW] = "redraw",
+	[TRACE_REDRAW_EVENT] = "redraw_event",
+	[TRACE_GRID_LINE] = "grid_line",
+	[TRACE_FLUSH] = "flush",
+	[TRACE_FRAME] = "frame",
+	[TRACE_KEY] = "key",
+	[TRACE_INPUT] = "input",
+	[TRACE_RPC_WRITE] = "rpc_write",
+	[TRACE_RESIZE] = "resize",
+	[TRACE_DROPPED] = "dropped",
+	[TRACE_REDRAW_COST] = "redraw_cost"
+};
+
+/* a message continues with the next TEXT_MORE from the same thread, other
+ * threads can have records in between */
+struct pending_text {
+	bool active;
+	uint64_t ns;
+	size_t used;
+	char buf[256];
+};
+
+static struct pending_text pending[64];
+
+static void print_head(uint64_t ns, uint64_t base, uint16_t thread, uint16_t ev)
+{
+	printf("%12.3f %2"PRIu16" %-12s", (double)(int64_t)(ns - base) / 1e6, thread,
+		ev < TRACE_EVENT_COUNT ? event_names[ev] : "unknown");
+}
+
+static void flush_text(uint16_t thread, uint64_t base)
+{
+	struct pending_text* p = &pending[thread % 64];
+	if (!p->active)
+		return;
+
+	print_head(p->ns, base, thread, TRACE_TEXT);
+	printf(" %.*s\n", (int) p->used, p->buf);
+	p->active = false;
+}
+
+static void add_text(const struct trace_record* rec, uint64_t base)
+{
+	struct pending_text* p = &pending[rec->thread % 64];
+	if (rec->event == TRACE_TEXT){
+		flush_text(rec->thread, base);
+		*p = (struct pending_text){.active = true, .ns = rec->ns};
+	}
+	else if (!p->active)
+		return;
+
+	const char* end = memchr(rec->text, '\0', TRACE_TEXT_LEN);
+	size_t n = end ? (size_t)(end - rec->text) : TRACE_TEXT_LEN;
+	if (n > sizeof(p->buf) - p->used)
+		n = sizeof(p->buf) - p->used;
+	memcpy(&p->buf[p->used], rec->text, n);
+	p->used += n;
+}
+
+static void print_record(const struct trace_record* r, uint64_t base)
+{
+	print_head(r->ns, base, r->thread, r->event);
+
+	switch (r->event){
+	case TRACE_READ:
+		printf(" bytes=%"PRIu64" buffered=%"PRIu64, r->size, r->arg[0]);
+	break;
+	case TRACE_MESSAGE:
+		printf(" size=%"PRIu64" type=%"PRIu64" id=%"PRIu64,
+			r->size, r->arg[0], r->arg[1]);
+	break;
+	case TRACE_REDRAW:
+		printf(" events=%"PRIu64, r->size);
+	break;
+	case TRACE_REDRAW_EVENT:
+		printf(" cmd=%"PRIu64" args=%"PRIu64, r->arg[0], r->size);
+	break;
+	case TRACE_GRID_LINE:
+		printf(" grid=%"PRIu32" row=%"PRIu64" col=%"PRIu64" cells=%"PRIu64,
+			r->grid, r->arg[0], r->arg[1], r->size);
+	break;
+	case TRACE_FLUSH:
+		printf(" since_redraw=%.1fus", (double) r->arg[0] / 1000.0);
+	break;
+	case TRACE_FRAME:
+		printf(" cells=%"PRIu64" apply=%.1fus", r->size, (double) r->arg[0] / 1000.0);
+	break;
+	case TRACE_KEY:
+		printf(" bytes=%"PRIu64" sym=%"PRIu64" mods=%"PRIu64,
+			r->size, r->arg[0], r->arg[1]);
+	break;
+	case TRACE_INPUT:
+		printf(" keys=%"PRIu64" bytes=%"PRIu64, r->size, r->arg[0]);
+	break;
+	case TRACE_RPC_WRITE:
+		printf(" bytes=%"PRIu64" writes=%"PRIu64, r->size, r->arg[0]);
+	break;
+	case TRACE_RESIZE:
+		printf(" grid=%"PRIu32" cols=%"PRIu64" rows=%"PRIu64,
+			r->grid, r->arg[0], r->arg[1]);
+	break;
+	case TRACE_REDRAW_COST:
+		printf(" %s cmd=%"PRIu64" calls=%"PRIu64" args=%"PRIu64
+			" total=%.1fus max=%.1fus", r->arg[4] ? "apply" : "decode",
+			r->arg[0], r->size, r->arg[3],
+			(double) r->arg[1] / 1000.0, (double) r->arg[2] / 1000.0);
+	break;
+	case TRACE_DROPPED:
+		printf(" records=%"PRIu64, r->size);
+	break;
+	default:
+		printf(" event=%"PRIu16, r->event);
+	break;
+	}
+
+	printf("\n");
+}
+
+int main(int argc, char** argv)
+{
+	FILE* fin = argc > 1 ? fopen(argv[1], "r") : stdin;
+	if (!fin){
+		fprintf(stderr, "couldn't open %s\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	char magic[8];
+	if (1 != fread(magic, 8, 1, fin) || memcmp(magic, TRACE_MAGIC, 8) != 0){
+		fprintf(stderr, "not a trace file\n");
+		return EXIT_FAILURE;
+	}
+
+	struct trace_record rec;
+	uint64_t base = 0;
+	uint64_t dropped = 0;
+	bool first = true;
+
+	while (1 == fread(&rec, sizeof(rec), 1, fin)){
+		if (first){
+			base = rec.ns;
+			first = false;
+		}
+
+		if (rec.event == TRACE_TEXT || rec.event == TRACE_TEXT_MORE){
+			add_text(&rec, base);
+			continue;
+		}
+
+		flush_text(rec.thread, base);
+		if (rec.event == TRACE_DROPPED)
+			dropped += rec.size;
+		print_record(&rec, base);
+	}
+
+	for (size_t i = 0; i < 64; i++)
+		flush_text(i, base);
+
+	if (dropped)
+		fprintf(stderr, "%"PRIu64" records were dropped (ring full)\n", dropped);
+
+	return EXIT_SUCCESS;
+}